@@ -3,107 +3,163 @@
 
 using namespace MachineBoss;
 
-BackwardMatrix::BackwardMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair) :
-  DPMatrix (machine, seqPair)
+template<class IndexMapper,class Cell>
+MappedBackwardMatrix<IndexMapper,Cell>::MappedBackwardMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const DPOptions& options) :
+  DPM (machine, seqPair, options)
 {
   fill();
 }
 
-BackwardMatrix::BackwardMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const Envelope& env) :
-  DPMatrix (machine, seqPair, env)
+template<class IndexMapper,class Cell>
+MappedBackwardMatrix<IndexMapper,Cell>::MappedBackwardMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const Envelope& env, const DPOptions& options) :
+  DPM (machine, seqPair, env, options)
 {
   fill();
 }
 
-void BackwardMatrix::fill() {
-  ProgressLog(plogDP,6);
-  plogDP.initProgress ("Filling Backward matrix (%lu cells)", nCellsComputed());
-  CellIndex nCellsDone = 0;
-  for (OutputIndex outPos = outLen; outPos >= 0; --outPos) {
-    const bool endOfOutput = (outPos == outLen);
-    const OutputToken outTok = endOfOutput ? OutputTokenizer::emptyToken() : output[outPos];
-    for (InputIndex inPos = env.inEnd[outPos] - 1; inPos >= env.inStart[outPos]; --inPos) {
-      const bool endOfInput = (inPos == inLen);
-      const InputToken inTok = endOfInput ? InputTokenizer::emptyToken() : input[inPos];
-      for (int s = nStates - 1; s >= 0; --s) {
-	plogDP.logProgress (nCellsDone / (double) nCellsComputed(), "filled %lu cells", nCellsDone);
-	++nCellsDone;
-	const bool endState = (s == nStates - 1);
-	const EvaluatedMachineState& state = machine.state[(StateIndex) s];
-	double ll = (endOfInput && endOfOutput && endState) ? 0 : -numeric_limits<double>::infinity();
-	if (!endOfInput && !endOfOutput)
-	  accumulate (ll, state.outgoing, inTok, outTok, inPos + 1, outPos + 1, sum_reduce);
-	if (!endOfInput)
-	  accumulate (ll, state.outgoing, inTok, OutputTokenizer::emptyToken(), inPos + 1, outPos, sum_reduce);
-	if (!endOfOutput)
-	  accumulate (ll, state.outgoing, InputTokenizer::emptyToken(), outTok, inPos, outPos + 1, sum_reduce);
-	accumulate (ll, state.outgoing, InputTokenizer::emptyToken(), OutputTokenizer::emptyToken(), inPos, outPos, sum_reduce);
-	cell(inPos,outPos,(StateIndex) s) = ll;
-      }
-    }
-  }
-  LogThisAt(8,"Backward matrix:" << endl << *this);
+template<class IndexMapper,class Cell>
+void MappedBackwardMatrix<IndexMapper,Cell>::fill() {
+  DPM::template fillOutgoing<LogSumSemiring> (DPM::machine.endState(), "Backward");
 }
 
-double BackwardMatrix::logLike() const {
-  return cell (0, 0, machine.startState());
+template<class IndexMapper,class Cell>
+double MappedBackwardMatrix<IndexMapper,Cell>::logLike() const {
+  if (DPM::options.local.enabled())
+    return DPM::template terminusLogLike<LogSumSemiring>();
+  return DPM::cell (0, 0, DPM::machine.startState());
 }
 
-BackwardMatrix::PostTransQueue BackwardMatrix::postTransQueue (const ForwardMatrix& forward) const {
+template class MachineBoss::MappedBackwardMatrix<IdentityIndexMapper,double>;
+template class MachineBoss::MappedBackwardMatrix<IdentityIndexMapper,float>;
+template class MachineBoss::MappedBackwardMatrix<RollingOutputIndexMapper,double>;
+
+template<class Cell>
+BasicBackwardMatrix<Cell>::BasicBackwardMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const DPOptions& options) :
+  MappedBackwardMatrix<IdentityIndexMapper,Cell> (machine, seqPair, options)
+{ }
+
+template<class Cell>
+BasicBackwardMatrix<Cell>::BasicBackwardMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const Envelope& env, const DPOptions& options) :
+  MappedBackwardMatrix<IdentityIndexMapper,Cell> (machine, seqPair, env, options)
+{ }
+
+template<class Cell>
+typename BasicBackwardMatrix<Cell>::PostTransQueue BasicBackwardMatrix<Cell>::postTransQueue (const ForwardMatrixType& forward) const {
   PostTransQueue ptq;
   getCounts (forward, transitionSorter (ptq));
   return ptq;
 }
 
-void BackwardMatrix::getCounts (const ForwardMatrix& forward, MachineCounts& counts) const {
+template<class Cell>
+void BasicBackwardMatrix<Cell>::getCounts (const ForwardMatrixType& forward, MachineCounts& counts) const {
   getCounts (forward, transitionCounter (counts));
 }
 
-void BackwardMatrix::getCounts (const ForwardMatrix& forward, const BackTransVisitor& transCount) const {
+template<class Cell>
+void BasicBackwardMatrix<Cell>::getCounts (const ForwardMatrixType& forward, const BackTransVisitor& transCount) const {
   ProgressLog(plogDP,6);
-  plogDP.initProgress ("Calculating posterior probabilities (%lu cells)", nCellsComputed());
-  CellIndex nCellsDone = 0;
-  const double ll = logLike();
-  for (OutputIndex outPos = outLen; outPos >= 0; --outPos) {
-    const bool endOfOutput = (outPos == outLen);
-    const OutputToken outTok = endOfOutput ? OutputTokenizer::emptyToken() : output[outPos];
-    for (InputIndex inPos = env.inEnd[outPos] - 1; inPos >= env.inStart[outPos]; --inPos) {
-      const bool endOfInput = (inPos == inLen);
-      const InputToken inTok = endOfInput ? InputTokenizer::emptyToken() : input[inPos];
-      for (int s = nStates - 1; s >= 0; --s) {
-	plogDP.logProgress (nCellsDone / (double) nCellsComputed(), "counted %lu cells", nCellsDone);
-	const bool endState = (s == nStates - 1);
-	const EvaluatedMachineState& state = machine.state[(StateIndex) s];
-	const double logOddsRatio = forward.cell(inPos,outPos,(StateIndex) s) - ll;
+  plogDP.initProgress ("Calculating posterior probabilities (%lu cells)", DPM::nCellsComputed());
+  typename DPM::CellIndex nCellsDone = 0;
+  const double ll = this->logLike();
+  const EvaluatedTransTable& outgoing = DPM::machine.outgoing;
+  vguard<double> logPostProb (outgoing.maxStateTrans), postProb (outgoing.maxStateTrans);
+  for (OutputIndex outPos = DPM::outLen; outPos >= 0; --outPos) {
+    const bool endOfOutput = (outPos == DPM::outLen);
+    const OutputToken outTok = endOfOutput ? OutputTokenizer::emptyToken() : DPM::output[outPos];
+    for (InputIndex inPos = DPM::env.inEnd[outPos] - 1; inPos >= DPM::env.inStart[outPos]; --inPos) {
+      const bool endOfInput = (inPos == DPM::inLen);
+      const InputToken inTok = endOfInput ? InputTokenizer::emptyToken() : DPM::input[inPos];
+      plogDP.logProgress (nCellsDone / (double) DPM::nCellsComputed(), "counted %lu cells", nCellsDone);
+      nCellsDone += DPM::nStates;
+      const EvaluatedTransTable::Offset begin = outgoing.activeBegin (inTok, outTok);
+      for (EvaluatedTransTable::Offset n = outgoing.activeEnd (inTok, outTok); n > begin; --n) {
+	const StateIndex s = outgoing.activeState[n-1];
+	const double logOddsRatio = forward.cell(inPos,outPos,s) - ll;
 	if (!endOfInput && !endOfOutput)
-	  accumulateCounts (logOddsRatio, transCount, s, state.outgoing, inTok, outTok, inPos + 1, outPos + 1);
+	  accumulateCounts (logOddsRatio, transCount, s, outgoing, inTok, outTok, inPos + 1, outPos + 1, logPostProb.data(), postProb.data());
 	if (!endOfInput)
-	  accumulateCounts (logOddsRatio, transCount, s, state.outgoing, inTok, OutputTokenizer::emptyToken(), inPos + 1, outPos);
+	  accumulateCounts (logOddsRatio, transCount, s, outgoing, inTok, OutputTokenizer::emptyToken(), inPos + 1, outPos, logPostProb.data(), postProb.data());
 	if (!endOfOutput)
-	  accumulateCounts (logOddsRatio, transCount, s, state.outgoing, InputTokenizer::emptyToken(), outTok, inPos, outPos + 1);
-	accumulateCounts (logOddsRatio, transCount, s, state.outgoing, InputTokenizer::emptyToken(), OutputTokenizer::emptyToken(), inPos, outPos);
+	  accumulateCounts (logOddsRatio, transCount, s, outgoing, InputTokenizer::emptyToken(), outTok, inPos, outPos + 1, logPostProb.data(), postProb.data());
+	accumulateCounts (logOddsRatio, transCount, s, outgoing, InputTokenizer::emptyToken(), OutputTokenizer::emptyToken(), inPos, outPos, logPostProb.data(), postProb.data());
       }
     }
   }
 }
 
-MachinePath BackwardMatrix::traceFrom (const Machine& machine, const ForwardMatrix& forward, InputIndex inPos, OutputIndex outPos, StateIndex state) const {
-  return forward.traceBack (machine, inPos, outPos, state).concatenate (traceForward (machine, inPos, outPos, state));
+template<class Cell>
+MachinePath BasicBackwardMatrix<Cell>::traceFrom (const Machine& machine, const ForwardMatrixType& forward, InputIndex inPos, OutputIndex outPos, StateIndex state) const {
+  return forward.traceBack (machine, inPos, outPos, state).concatenate (DPM::traceForward (machine, inPos, outPos, state));
 }
 
-MachinePath BackwardMatrix::traceFrom (const Machine& machine, const ForwardMatrix& forward, InputIndex inPos, OutputIndex outPos, StateIndex state, EvaluatedMachineState::TransIndex transIndex) const {
+template<class Cell>
+MachinePath BasicBackwardMatrix<Cell>::traceFrom (const Machine& machine, const ForwardMatrixType& forward, InputIndex inPos, OutputIndex outPos, StateIndex state, EvaluatedMachineState::TransIndex transIndex) const {
   return forward.traceBack (machine, inPos, outPos, state)
     .concatenate (MachinePath (machine.state[state].getTransition (transIndex))
-		  .concatenate (traceForward (machine, inPos, outPos, state)));
+		  .concatenate (DPM::traceForward (machine, inPos, outPos, state)));
 }
 
-void BackwardMatrix::traceFrom (const Machine& machine, const ForwardMatrix& forward, InputIndex inPos, OutputIndex outPos, StateIndex state, EvaluatedMachineState::TransIndex transIndex, TraceTerminator stopTrace) const {
+template<class Cell>
+void BasicBackwardMatrix<Cell>::traceFrom (const Machine& machine, const ForwardMatrixType& forward, InputIndex inPos, OutputIndex outPos, StateIndex state, EvaluatedMachineState::TransIndex transIndex, TraceTerminator stopTrace) const {
   if (!stopTrace (inPos, outPos, state, transIndex)) {
     forward.traceBack (machine, inPos, outPos, state, stopTrace);
     const MachineState& ms = machine.state[state];
     const MachineTransition& mt = ms.getTransition (transIndex);
     const InputIndex nextInPos = inPos + (mt.inputEmpty() ? 0 : 1);
     const OutputIndex nextOutPos = outPos + (mt.outputEmpty() ? 0 : 1);
-    traceForward (machine, nextInPos, nextOutPos, mt.dest, stopTrace);
+    DPM::traceForward (machine, nextInPos, nextOutPos, mt.dest, stopTrace);
+  }
+}
+
+template class MachineBoss::BasicBackwardMatrix<double>;
+template class MachineBoss::BasicBackwardMatrix<float>;
+
+CheckpointedBackwardMatrix::CheckpointedBackwardMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const Envelope& env, CheckpointedForwardMatrix& forward, const BackTransVisitor& transCount) :
+  DPMatrix (machine, seqPair, env, forward.options)
+{
+  fill (forward, transCount);
+}
+
+CheckpointedBackwardMatrix::CheckpointedBackwardMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const Envelope& env, CheckpointedForwardMatrix& forward, MachineCounts& counts) :
+  DPMatrix (machine, seqPair, env, forward.options)
+{
+  fill (forward, BackwardMatrix::transitionCounter (counts));
+}
+
+// The posterior probabilities use the Forward log-likelihood, since the Backward matrix is incomplete until the last row
+void CheckpointedBackwardMatrix::fill (CheckpointedForwardMatrix& forward, const BackTransVisitor& transCount) {
+  ProgressLog(plogDP,6);
+  plogDP.initProgress ("Filling Backward matrix and calculating posterior probabilities (%ld rows)", outLen + 1);
+  const double ll = forward.logLike();
+  vguard<double> terms (machine.outgoing.maxStateTrans + 1), logPostProb (machine.outgoing.maxStateTrans), postProb (machine.outgoing.maxStateTrans);
+  for (OutputIndex outPos = outLen; outPos >= 0; --outPos) {
+    plogDP.logProgress ((outLen - outPos) / (double) (outLen + 1), "row %ld", outPos);
+    for (InputIndex inPos = env.inEnd[outPos] - 1; inPos >= env.inStart[outPos]; --inPos)
+      fillOutgoingCell<LogSumSemiring> (inPos, outPos, machine.endState(), terms.data());
+    forward.loadBlock (outPos);
+    const bool endOfOutput = (outPos == outLen);
+    const OutputToken outTok = endOfOutput ? OutputTokenizer::emptyToken() : output[outPos];
+    for (InputIndex inPos = env.inEnd[outPos] - 1; inPos >= env.inStart[outPos]; --inPos) {
+      const bool endOfInput = (inPos == inLen);
+      const InputToken inTok = endOfInput ? InputTokenizer::emptyToken() : input[inPos];
+      const EvaluatedTransTable::Offset begin = machine.outgoing.activeBegin (inTok, outTok);
+      for (EvaluatedTransTable::Offset n = machine.outgoing.activeEnd (inTok, outTok); n > begin; --n) {
+	const StateIndex s = machine.outgoing.activeState[n-1];
+	const double logOddsRatio = forward.cell(inPos,outPos,s) - ll;
+	if (!endOfInput && !endOfOutput)
+	  accumulateCounts (logOddsRatio, transCount, s, inTok, outTok, inPos + 1, outPos + 1, logPostProb.data(), postProb.data());
+	if (!endOfInput)
+	  accumulateCounts (logOddsRatio, transCount, s, inTok, OutputTokenizer::emptyToken(), inPos + 1, outPos, logPostProb.data(), postProb.data());
+	if (!endOfOutput)
+	  accumulateCounts (logOddsRatio, transCount, s, InputTokenizer::emptyToken(), outTok, inPos, outPos + 1, logPostProb.data(), postProb.data());
+	accumulateCounts (logOddsRatio, transCount, s, InputTokenizer::emptyToken(), OutputTokenizer::emptyToken(), inPos, outPos, logPostProb.data(), postProb.data());
+      }
+    }
   }
 }
+
+double CheckpointedBackwardMatrix::logLike() const {
+  if (options.local.enabled())
+    return terminusLogLike<LogSumSemiring>();
+  return cell (0, 0, machine.startState());
+}
@@ -7,8 +7,31 @@
 
 namespace MachineBoss {
 
-class BackwardMatrix : public DPMatrix<IdentityIndexMapper> {
+// Cell is the storage type for cells; the instantiations are in backward.cpp
+template<class IndexMapper, class Cell = double>
+class MappedBackwardMatrix : public DPMatrix<IndexMapper,Cell> {
 public:
+  typedef DPMatrix<IndexMapper,Cell> DPM;
+private:
+  void fill();
+public:
+  MappedBackwardMatrix (const EvaluatedMachine&, const SeqPair&, const DPOptions& = DPOptions());
+  MappedBackwardMatrix (const EvaluatedMachine&, const SeqPair&, const Envelope&, const DPOptions& = DPOptions());
+  double logLike() const;
+};
+
+typedef MappedBackwardMatrix<RollingOutputIndexMapper> RollingOutputBackwardMatrix;  // score only
+
+// Backward matrix storing all cells, for posterior probabilities & counts
+template<class Cell>
+class BasicBackwardMatrix : public MappedBackwardMatrix<IdentityIndexMapper,Cell> {
+public:
+  typedef DPMatrix<IdentityIndexMapper,Cell> DPM;
+  typedef MappedForwardMatrix<IdentityIndexMapper,Cell> ForwardMatrixType;
+  typedef typename DPM::InputIndex InputIndex;
+  typedef typename DPM::OutputIndex OutputIndex;
+  typedef typename DPM::TraceTerminator TraceTerminator;
+
   typedef function<void(StateIndex,EvaluatedMachineState::TransIndex,InputIndex,OutputIndex,double)> BackTransVisitor;
   static BackTransVisitor transitionCounter (MachineCounts& counts) {
     BackTransVisitor tv = [&] (StateIndex s, EvaluatedMachineState::TransIndex ti, InputIndex, OutputIndex, double postProb) {
@@ -34,25 +57,57 @@ public:
   }
 
 private:
-  inline void accumulateCounts (double logOddsRatio, const BackTransVisitor& tv, StateIndex src, const EvaluatedMachineState::InOutStateTransMap& inOutStateTransMap, InputToken inTok, OutputToken outTok, InputIndex inPos, OutputIndex outPos) const {
-    auto visit = [&] (StateIndex, EvaluatedMachineState::TransIndex ti, double tll) {
-      tv (src, ti, inPos, outPos, exp (logOddsRatio + tll));
-    };
-    iterate (inOutStateTransMap, inTok, outTok, inPos, outPos, visit);
+  inline void accumulateCounts (double logOddsRatio, const BackTransVisitor& tv, StateIndex src, const EvaluatedTransTable& transTable, InputToken inTok, OutputToken outTok, InputIndex inPos, OutputIndex outPos, double* logPostProb, double* postProb) const {
+    const EvaluatedTransTable::Offset begin = transTable.begin (src, inTok, outTok), end = transTable.end (src, inTok, outTok);
+    if (begin == end)
+      return;
+    for (EvaluatedTransTable::Offset n = begin; n < end; ++n)
+      logPostProb[n - begin] = logOddsRatio + DPM::cell(inPos,outPos,transTable.state[n]) + transTable.logWeight[n];
+    exp_array (logPostProb, postProb, end - begin);
+    for (EvaluatedTransTable::Offset n = begin; n < end; ++n)
+      tv (src, transTable.transIndex[n], inPos, outPos, postProb[n - begin]);
   }
 
-  void fill();
-  
 public:
-  BackwardMatrix (const EvaluatedMachine&, const SeqPair&);
-  BackwardMatrix (const EvaluatedMachine&, const SeqPair&, const Envelope&);
-  void getCounts (const ForwardMatrix&, const BackTransVisitor&) const;
-  void getCounts (const ForwardMatrix&, MachineCounts&) const;
+  BasicBackwardMatrix (const EvaluatedMachine&, const SeqPair&, const DPOptions& = DPOptions());
+  BasicBackwardMatrix (const EvaluatedMachine&, const SeqPair&, const Envelope&, const DPOptions& = DPOptions());
+  void getCounts (const ForwardMatrixType&, const BackTransVisitor&) const;
+  void getCounts (const ForwardMatrixType&, MachineCounts&) const;
+  PostTransQueue postTransQueue (const ForwardMatrixType&) const;
+  MachinePath traceFrom (const Machine&, const ForwardMatrixType&, InputIndex, OutputIndex, StateIndex) const;
+  MachinePath traceFrom (const Machine&, const ForwardMatrixType&, InputIndex, OutputIndex, StateIndex, EvaluatedMachineState::TransIndex) const;
+  void traceFrom (const Machine&, const ForwardMatrixType&, InputIndex, OutputIndex, StateIndex, EvaluatedMachineState::TransIndex, TraceTerminator) const;
+};
+
+typedef BasicBackwardMatrix<double> BackwardMatrix;
+typedef BasicBackwardMatrix<float> FloatBackwardMatrix;
+
+// Forward-Backward counts in O(sqrt(outLen)) rows of memory.
+// Only two Backward rows are kept. The counts for each output row are accumulated as soon as its Backward row is filled,
+// recomputing the block of the CheckpointedForwardMatrix that contains the row when necessary.
+class CheckpointedBackwardMatrix : public DPMatrix<RollingOutputIndexMapper> {
+public:
+  typedef BackwardMatrix::BackTransVisitor BackTransVisitor;
+
+private:
+  inline void accumulateCounts (double logOddsRatio, const BackTransVisitor& tv, StateIndex src, InputToken inTok, OutputToken outTok, InputIndex inPos, OutputIndex outPos, double* logPostProb, double* postProb) const {
+    const EvaluatedTransTable& outgoing = machine.outgoing;
+    const EvaluatedTransTable::Offset begin = outgoing.begin (src, inTok, outTok), end = outgoing.end (src, inTok, outTok);
+    if (begin == end)
+      return;
+    for (EvaluatedTransTable::Offset n = begin; n < end; ++n)
+      logPostProb[n - begin] = logOddsRatio + cell(inPos,outPos,outgoing.state[n]) + outgoing.logWeight[n];
+    exp_array (logPostProb, postProb, end - begin);
+    for (EvaluatedTransTable::Offset n = begin; n < end; ++n)
+      tv (src, outgoing.transIndex[n], inPos, outPos, postProb[n - begin]);
+  }
+
+  void fill (CheckpointedForwardMatrix&, const BackTransVisitor&);
+
+public:
+  CheckpointedBackwardMatrix (const EvaluatedMachine&, const SeqPair&, const Envelope&, CheckpointedForwardMatrix&, const BackTransVisitor&);  // Envelope must match the CheckpointedForwardMatrix, whose DPOptions are used
+  CheckpointedBackwardMatrix (const EvaluatedMachine&, const SeqPair&, const Envelope&, CheckpointedForwardMatrix&, MachineCounts&);
   double logLike() const;
-  PostTransQueue postTransQueue (const ForwardMatrix&) const;
-  MachinePath traceFrom (const Machine&, const ForwardMatrix&, InputIndex, OutputIndex, StateIndex) const;
-  MachinePath traceFrom (const Machine&, const ForwardMatrix&, InputIndex, OutputIndex, StateIndex, EvaluatedMachineState::TransIndex) const;
-  void traceFrom (const Machine&, const ForwardMatrix&, InputIndex, OutputIndex, StateIndex, EvaluatedMachineState::TransIndex, TraceTerminator) const;
 };
 
 }  // end namespace
@@ -0,0 +1,134 @@
+#include "batch.h"
+#include "logsumexp.h"
+#include "logger.h"
+
+using namespace MachineBoss;
+
+BatchTransTable::BatchTransTable (const EvaluatedMachine& machine) :
+  nInToks (machine.inputTokenizer.tok2sym.size()),
+  nOutToks (machine.outputTokenizer.tok2sym.size())
+{
+  const size_t tableSize[] = { (size_t) (nInToks + 1) * (nOutToks + 1), (size_t) nInToks + 1, (size_t) nOutToks + 1, 1 };
+  const StateIndex nStates = machine.nStates();
+  entryOffset.reserve (nStates * nTransClasses + 1);
+  for (StateIndex d = 0; d < nStates; ++d) {
+    vguard<map<StateIndex,vguard<LogWeight> > > classSrcWeight (nTransClasses);
+    for (const auto& in_ost: machine.state[d].incoming)
+      for (const auto& out_st: in_ost.second)
+	for (const auto& s_t: out_st.second) {
+	  const InputToken inTok = in_ost.first;
+	  const OutputToken outTok = out_st.first;
+	  const TransClass c = inTok ? (outTok ? Match : Delete) : (outTok ? Insert : Null);
+	  vguard<LogWeight>& w = classSrcWeight[c][s_t.first];
+	  if (w.empty())
+	    w.resize (tableSize[c], -numeric_limits<double>::infinity());
+	  LogWeight& lw = w[c == Match ? (inTok * (nOutToks + 1) + outTok) : (c == Delete ? inTok : (c == Insert ? outTok : 0))];
+	  lw = log_sum_exp (lw, s_t.second.logWeight);
+	}
+    for (int c = 0; c < nTransClasses; ++c) {
+      entryOffset.push_back (src.size());
+      for (const auto& s_w: classSrcWeight[c]) {
+	src.push_back (s_w.first);
+	weightOffset.push_back (logWeight.size());
+	logWeight.insert (logWeight.end(), s_w.second.begin(), s_w.second.end());
+      }
+    }
+  }
+  entryOffset.push_back (src.size());
+}
+
+BatchForwardMatrix::BatchForwardMatrix (const EvaluatedMachine& machine, const BatchTransTable& table, const vguard<const SeqPair*>& seqPairs) :
+  machine (machine),
+  table (table),
+  nLanes (seqPairs.size()),
+  nStates (machine.nStates()),
+  maxInLen (0),
+  maxOutLen (0),
+  laneLogLike (nLanes, -numeric_limits<double>::infinity())
+{
+  Assert (nLanes > 0 && nLanes <= MaxBatchLanes, "Batch must have between 1 and %d sequence pairs", MaxBatchLanes);
+  for (const auto seqPair: seqPairs) {
+    input.push_back (machine.inputTokenizer.tokenize (seqPair->input.seq));
+    output.push_back (machine.outputTokenizer.tokenize (seqPair->output.seq));
+    maxInLen = max (maxInLen, (InputIndex) input.back().size());
+    maxOutLen = max (maxOutLen, (OutputIndex) output.back().size());
+  }
+  BatchTransTable::Offset maxTerms = 0;
+  for (StateIndex d = 0; d < nStates; ++d)
+    maxTerms = max (maxTerms, table.begin (d + 1, BatchTransTable::Match) - table.begin (d, BatchTransTable::Match));
+  terms.resize ((maxTerms + 1) * MaxBatchLanes);
+  LogThisAt(7,"Creating batched Forward matrix with " << nLanes << " lanes and " << (2 * (maxInLen + 1) * nStates) << " cells per lane (" << (maxInLen+1) << "*2*" << nStates << ")" << endl);
+  cellStorage.resize (2 * (maxInLen + 1) * nStates * MaxBatchLanes, -numeric_limits<double>::infinity());
+  fill();
+}
+
+void BatchForwardMatrix::fill() {
+  ProgressLog(plogDP,6);
+  plogDP.initProgress ("Filling batched Forward matrix (%lu lanes, %ld rows)", nLanes, maxOutLen + 1);
+  for (OutputIndex outPos = 0; outPos <= maxOutLen; ++outPos) {
+    plogDP.logProgress (outPos / (double) (maxOutLen + 1), "row %ld", outPos);
+    for (InputIndex inPos = 0; inPos <= maxInLen; ++inPos)
+      fillCell (inPos, outPos);
+    for (size_t lane = 0; lane < nLanes; ++lane)
+      if ((OutputIndex) output[lane].size() == outPos)
+	laneLogLike[lane] = cellLanes (input[lane].size(), outPos, machine.endState())[lane];
+  }
+}
+
+void BatchForwardMatrix::fillCell (InputIndex inPos, OutputIndex outPos) {
+  InputToken inTok[MaxBatchLanes];
+  OutputToken outTok[MaxBatchLanes];
+  for (size_t lane = 0; lane < MaxBatchLanes; ++lane) {
+    const bool used = lane < nLanes;
+    inTok[lane] = inPos == 0 ? InputTokenizer::emptyToken() : (used && inPos <= (InputIndex) input[lane].size() ? input[lane][inPos-1] : table.inPad());
+    outTok[lane] = outPos == 0 ? OutputTokenizer::emptyToken() : (used && outPos <= (OutputIndex) output[lane].size() ? output[lane][outPos-1] : table.outPad());
+  }
+  for (StateIndex d = 0; d < nStates; ++d) {
+    double* term = terms.data();
+    auto gather = [&] (BatchTransTable::TransClass c, InputIndex srcInPos, OutputIndex srcOutPos) {
+      const BatchTransTable::Offset end = table.end (d, c);
+      for (BatchTransTable::Offset e = table.begin (d, c); e < end; ++e) {
+	const double* src = cellLanes (srcInPos, srcOutPos, table.src[e]);
+	for (size_t lane = 0; lane < MaxBatchLanes; ++lane)
+	  term[lane] = src[lane] + table.weight (e, c, inTok[lane], outTok[lane]);
+	term += MaxBatchLanes;
+      }
+    };
+    if (!inPos && !outPos && d == machine.startState()) {
+      for (size_t lane = 0; lane < MaxBatchLanes; ++lane)
+	term[lane] = 0;
+      term += MaxBatchLanes;
+    }
+    if (inPos && outPos)
+      gather (BatchTransTable::Match, inPos - 1, outPos - 1);
+    if (inPos)
+      gather (BatchTransTable::Delete, inPos - 1, outPos);
+    if (outPos)
+      gather (BatchTransTable::Insert, inPos, outPos - 1);
+    gather (BatchTransTable::Null, inPos, outPos);
+
+    // log-sum-exp of each lane's terms
+    double* dest = cellLanes (inPos, outPos, d);
+    const size_t nValues = term - terms.data();
+    double* t = terms.data();
+    double laneMax[MaxBatchLanes], laneSum[MaxBatchLanes];
+    for (size_t lane = 0; lane < MaxBatchLanes; ++lane)
+      laneMax[lane] = -numeric_limits<double>::infinity();
+    for (size_t n = 0; n < nValues; n += MaxBatchLanes)
+      for (size_t lane = 0; lane < MaxBatchLanes; ++lane)
+	laneMax[lane] = max (laneMax[lane], t[n + lane]);
+    for (size_t lane = 0; lane < MaxBatchLanes; ++lane)
+      laneMax[lane] = laneMax[lane] == -numeric_limits<double>::infinity() ? 0 : laneMax[lane];  // all terms are -infinity, so avoid (-infinity) - (-infinity)
+    for (size_t n = 0; n < nValues; n += MaxBatchLanes)
+      for (size_t lane = 0; lane < MaxBatchLanes; ++lane)
+	t[n + lane] -= laneMax[lane];
+    exp_array (t, t, nValues);
+    for (size_t lane = 0; lane < MaxBatchLanes; ++lane)
+      laneSum[lane] = 0;
+    for (size_t n = 0; n < nValues; n += MaxBatchLanes)
+      for (size_t lane = 0; lane < MaxBatchLanes; ++lane)
+	laneSum[lane] += t[n + lane];
+    for (size_t lane = 0; lane < nLanes; ++lane)  // log is not vectorized, so skip the unused lanes
+      dest[lane] = laneMax[lane] + log (laneSum[lane]);
+  }
+}
@@ -0,0 +1,86 @@
+#ifndef BATCH_INCLUDED
+#define BATCH_INCLUDED
+
+#include "eval.h"
+#include "seqpair.h"
+
+#define MaxBatchLanes 8
+
+namespace MachineBoss {
+
+// Incoming transitions of an EvaluatedMachine, regrouped for BatchForwardMatrix.
+// Transitions into each destination state are grouped by class (which of input & output they consume)
+// and then by source state, so that one traversal of the table serves sequence pairs with different tokens.
+// Each (destination, class, source) entry has a dense table of log-weights indexed by the consumed tokens,
+// including one extra "padding" token (with weight -infinity) for positions beyond the end of a sequence.
+// Parallel transitions with the same tokens are merged by summing their weights.
+struct BatchTransTable {
+  enum TransClass { Match = 0, Delete = 1, Insert = 2, Null = 3 };  // consume both, input only, output only, or neither
+  static const int nTransClasses = 4;
+  typedef size_t Offset;
+
+  InputToken nInToks;  // including the empty token, but not the padding token
+  OutputToken nOutToks;
+  vguard<Offset> entryOffset;  // entries for (dest,class) are [entryOffset[dest*nTransClasses+class], entryOffset[dest*nTransClasses+class+1])
+  vguard<StateIndex> src;  // source state of each entry
+  vguard<Offset> weightOffset;  // offset of each entry's log-weight table in logWeight
+  vguard<LogWeight> logWeight;
+
+  BatchTransTable (const EvaluatedMachine&);
+
+  inline InputToken inPad() const { return nInToks; }
+  inline OutputToken outPad() const { return nOutToks; }
+  inline Offset begin (StateIndex dest, TransClass c) const { return entryOffset[dest * nTransClasses + c]; }
+  inline Offset end (StateIndex dest, TransClass c) const { return entryOffset[dest * nTransClasses + c + 1]; }
+  inline LogWeight weight (Offset entry, TransClass c, InputToken inTok, OutputToken outTok) const {
+    const LogWeight* w = logWeight.data() + weightOffset[entry];
+    switch (c) {
+    case Match: return w[inTok * (nOutToks + 1) + outTok];
+    case Delete: return w[inTok];
+    case Insert: return w[outTok];
+    default: break;
+    }
+    return w[0];
+  }
+};
+
+// Forward algorithm for a batch of up to MaxBatchLanes sequence pairs, computed in lockstep.
+// Each cell holds one log-likelihood per lane (i.e. per sequence pair), stored contiguously,
+// so every transition is visited once per cell for all lanes, and each cell's log-sum-exp is one vectorized batch (exp_array).
+// Cells always have MaxBatchLanes lanes, however many are in use, so that the per-lane loops have a fixed trip count
+// and can be vectorized by the compiler; unused lanes see padding tokens, and are never read.
+// The fill covers the largest input & output lengths in the batch, keeping two output rows;
+// lanes with shorter sequences see padding tokens, and their log-likelihoods are read off when their final row is filled.
+// Pairs of similar lengths should therefore be batched together.
+class BatchForwardMatrix {
+public:
+  typedef long InputIndex;
+  typedef long OutputIndex;
+
+private:
+  const EvaluatedMachine& machine;
+  const BatchTransTable& table;
+  const size_t nLanes;
+  const StateIndex nStates;
+  vguard<vguard<InputToken> > input;  // input[lane][inPos-1]
+  vguard<vguard<OutputToken> > output;
+  InputIndex maxInLen;
+  OutputIndex maxOutLen;
+  vguard<double> cellStorage;  // two output rows
+  vguard<double> terms;  // MaxBatchLanes values per term
+  vguard<double> laneLogLike;
+
+  inline double* cellLanes (InputIndex inPos, OutputIndex outPos, StateIndex s) {
+    return cellStorage.data() + (((outPos % 2) * (maxInLen + 1) + inPos) * nStates + s) * MaxBatchLanes;
+  }
+  void fill();
+  void fillCell (InputIndex inPos, OutputIndex outPos);
+
+public:
+  BatchForwardMatrix (const EvaluatedMachine&, const BatchTransTable&, const vguard<const SeqPair*>&);
+  const vguard<double>& logLike() const { return laneLogLike; }  // one per sequence pair, in batch order
+};
+
+}  // end namespace
+
+#endif /* BATCH_INCLUDED */
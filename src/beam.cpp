@@ -39,22 +39,14 @@ BeamSearchMatrix::BeamSearchMatrix (const EvaluatedMachine& machine, const vguar
     for (StateIndex dest = 0; dest < nStates; ++dest) {
       plogDP.logProgress ((nStates * outPos + dest) / (double) nCells(), "filled %lu cells", nStates * outPos + dest);
       Cell& destCell = cell (outPos, dest);
-      const EvaluatedMachineState::InOutStateTransMap& inOutStateTransMap = machine.state[dest].incoming;
-      for (const auto& tok_ostm: inOutStateTransMap) {
-	const InputToken inTok = tok_ostm.first;
-	if (inTok) {
-	  const EvaluatedMachineState::OutStateTransMap& outStateTransMap = tok_ostm.second;
-	  if (outPos > 0)
-	    accumulate (destCell, outStateTransMap, inTok, output[outPos-1], outPos - 1);
-	  accumulate (destCell, outStateTransMap, inTok, 0, outPos);
-	}
-      }
-      if (inOutStateTransMap.count (0)) {
-	const EvaluatedMachineState::OutStateTransMap& outStateTransMap = inOutStateTransMap.at(0);
-	  if (outPos > 0)
-	    accumulate (destCell, outStateTransMap, 0, output[outPos-1], outPos - 1);
-	  accumulate (destCell, outStateTransMap, 0, 0, outPos);
+      for (InputToken inTok = 1; inTok < inToks; ++inTok) {
+	if (outPos > 0)
+	  accumulate (destCell, dest, inTok, output[outPos-1], outPos - 1);
+	accumulate (destCell, dest, inTok, 0, outPos);
       }
+      if (outPos > 0)
+	accumulate (destCell, dest, 0, output[outPos-1], outPos - 1);
+      accumulate (destCell, dest, 0, 0, outPos);
       if (destCell.logWeight.size() > beamWidth) {
 	vguard<SeqNodePtr> seqs = extract_keys (destCell.logWeight);
 	partial_sort (seqs.begin(), seqs.begin() + beamWidth, seqs.end(), destCell);
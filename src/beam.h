@@ -60,17 +60,16 @@ struct BeamSearchMatrix {
     return cellStore [cellIndex (outPos, state)];
   }
 
-  inline void accumulate (Cell& destCell, const EvaluatedMachineState::OutStateTransMap& outStateTransMap, InputToken inTok, OutputToken outTok, OutputIndex outPos) {
-    if (outStateTransMap.count (outTok)) {
-      for (const auto& st: outStateTransMap.at (outTok)) {
-	const EvaluatedMachineState::Trans& trans = st.second;
-	const Cell& srcCell = cell (outPos, st.first);
-	for (const auto& seq_lw: srcCell.logWeight) {
-	  const SeqNodePtr prevNode = seq_lw.first;
-	  const SeqNodePtr node = inTok ? extendSeq(prevNode,inTok) : prevNode;
-	  const LogWeight lw = seq_lw.second + trans.logWeight;
-	  destCell.logWeight[node] = destCell.logWeight.count(node) ? log_sum_exp (destCell.logWeight.at(node), lw) : lw;
-	}
+  inline void accumulate (Cell& destCell, StateIndex dest, InputToken inTok, OutputToken outTok, OutputIndex outPos) {
+    const EvaluatedTransTable& incoming = machine.incoming;
+    const EvaluatedTransTable::Offset end = incoming.end (dest, inTok, outTok);
+    for (EvaluatedTransTable::Offset n = incoming.begin (dest, inTok, outTok); n < end; ++n) {
+      const Cell& srcCell = cell (outPos, incoming.state[n]);
+      for (const auto& seq_lw: srcCell.logWeight) {
+	const SeqNodePtr prevNode = seq_lw.first;
+	const SeqNodePtr node = inTok ? extendSeq(prevNode,inTok) : prevNode;
+	const LogWeight lw = seq_lw.second + incoming.logWeight[n];
+	destCell.logWeight[node] = destCell.logWeight.count(node) ? log_sum_exp (destCell.logWeight.at(node), lw) : lw;
       }
     }
   }
@@ -0,0 +1,60 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "cellstore.h"
+#include "logger.h"
+
+using namespace MachineBoss;
+
+atomic<size_t> ScratchFileMap::nMapped (0);
+
+void ScratchFileMap::map (const string& dir, size_t n) {
+  unmap();
+  if (n == 0)
+    return;
+#ifdef __EMSCRIPTEN__
+  Fail ("Memory-mapped DP matrices are not supported in this build");
+#else
+  string path = dir + "/bossdpXXXXXX";
+  const int fd = mkstemp (&path[0]);
+  Require (fd >= 0, "Can't create DP scratch file in %s: %s", dir.c_str(), strerror(errno));
+  unlink (path.c_str());
+  // reserve the disk space now, so that running out of space is an error here, rather than a SIGBUS during the fill
+#ifdef __APPLE__
+  // no posix_fallocate on macOS: preallocate with F_PREALLOCATE (contiguously if possible), then extend the file over it
+  int allocErr = 0;
+  fstore_t store = { F_ALLOCATECONTIG, F_PEOFPOSMODE, 0, (off_t) n, 0 };
+  if (fcntl (fd, F_PREALLOCATE, &store) == -1) {
+    store.fst_flags = F_ALLOCATEALL;
+    if (fcntl (fd, F_PREALLOCATE, &store) == -1)
+      allocErr = errno;
+  }
+  if (!allocErr && ftruncate (fd, n) == -1)
+    allocErr = errno;
+#else
+  const int allocErr = posix_fallocate (fd, 0, n);
+#endif
+  if (allocErr) {
+    close (fd);
+    Fail ("Can't allocate %zu bytes for DP scratch file in %s: %s", n, dir.c_str(), strerror(allocErr));
+  }
+  void* p = mmap (NULL, n, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  const int mapErr = errno;
+  close (fd);  // the mapping keeps the file open
+  Require (p != MAP_FAILED, "Can't memory-map %zu bytes of DP scratch file: %s", n, strerror(mapErr));
+  data = p;
+  bytes = n;
+  ++nMapped;
+  LogThisAt(7,"Mapped " << n << " bytes of DP scratch file in " << dir << endl);
+#endif
+}
+
+void ScratchFileMap::unmap() {
+#ifndef __EMSCRIPTEN__
+  if (data)
+    munmap (data, bytes);
+#endif
+  data = NULL;
+  bytes = 0;
+}
@@ -0,0 +1,98 @@
+#ifndef CELLSTORE_INCLUDED
+#define CELLSTORE_INCLUDED
+
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include "vguard.h"
+#include "util.h"
+
+namespace MachineBoss {
+
+using namespace std;
+
+// A memory-mapped scratch file. The file is unlinked as soon as it is created, so it is deleted when unmapped (or if the process dies).
+class ScratchFileMap {
+public:
+  void* data;
+  size_t bytes;
+  ScratchFileMap() : data(NULL), bytes(0) { }
+  ScratchFileMap (const ScratchFileMap&) = delete;
+  ScratchFileMap& operator= (const ScratchFileMap&) = delete;
+  ~ScratchFileMap() { unmap(); }
+  void map (const string& dir, size_t bytes);
+  void unmap();
+  static atomic<size_t> nMapped;  // number of scratch files mapped so far by this process
+};
+
+// Cell storage for DP matrices: a vector in RAM, or an array in a memory-mapped scratch file.
+// Out-of-core storage (DPOptions::scratchDir) lets matrices bigger than RAM be paged to and from disk, instead of failing to allocate.
+// Cells are laid out by output row, then input position, then state, which is the order in which the fills visit them,
+// so filling a mapped matrix streams through the file.
+template<class Cell>
+class CellStorage {
+private:
+  vguard<Cell> ram;
+  ScratchFileMap file;
+  string scratchDir;  // directory of the scratch file, if mapped
+  Cell* cells;
+  size_t nCells;
+
+public:
+  CellStorage() : cells(NULL), nCells(0) { }
+  CellStorage (const CellStorage& c) : cells(NULL), nCells(0) { *this = c; }
+  CellStorage& operator= (const CellStorage& c) {
+    if (this != &c) {
+      resize (c.size(), Cell(), c.scratchDir);
+      std::copy (c.cells, c.cells + c.nCells, cells);
+    }
+    return *this;
+  }
+
+  inline size_t size() const { return nCells; }
+  inline bool mapped() const { return file.data != NULL; }
+
+  // (re)allocates n cells with the given value; if dir is nonempty, the cells go in a scratch file in that directory
+  void resize (size_t n, Cell value, const string& dir = string()) {
+    ram.clear();
+    ram.shrink_to_fit();
+    file.unmap();
+    nCells = n;
+    scratchDir = dir;
+    if (!dir.empty()) {
+      file.map (dir, n * sizeof(Cell));
+      cells = (Cell*) file.data;
+      std::fill (cells, cells + n, value);
+    } else {
+      ram.resize (n, value);
+      cells = ram.data();
+    }
+  }
+
+  inline Cell& operator[] (size_t n) {
+#ifdef USE_VECTOR_GUARDS
+    if (n >= nCells) {
+      std::cerr << "cell storage overflow: element " << n << ", size is " << nCells << std::endl;
+      printStackTrace();
+      throw;
+    }
+#endif  /* USE_VECTOR_GUARDS */
+    return cells[n];
+  }
+
+  inline const Cell& operator[] (size_t n) const {
+#ifdef USE_VECTOR_GUARDS
+    if (n >= nCells) {
+      std::cerr << "const cell storage overflow: element " << n << ", size is " << nCells << std::endl;
+      printStackTrace();
+      throw;
+    }
+#endif  /* USE_VECTOR_GUARDS */
+    return cells[n];
+  }
+};
+
+}  // end namespace
+
+#endif /* CELLSTORE_INCLUDED */
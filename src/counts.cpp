@@ -2,6 +2,9 @@
 #include <gsl/gsl_multimin.h>
 #include "counts.h"
 #include "backward.h"
+#include "scaled.h"
+#include "planner.h"
+#include "weightvm.h"
 #include "util.h"
 #include "logger.h"
 
@@ -28,18 +31,21 @@ MachineCounts::MachineCounts (const EvaluatedMachine& machine) {
   init (machine);
 }
 
-MachineCounts::MachineCounts (const EvaluatedMachine& machine, const SeqPair& seqPair)
+MachineCounts::MachineCounts (const EvaluatedMachine& machine, const SeqPair& seqPair, const DPOptions& options)
 {
   init (machine);
-  (void) add (machine, seqPair);
+  (void) add (machine, seqPair, options);
 }
 
-MachineCounts::MachineCounts (const EvaluatedMachine& machine, const SeqPairList& seqPairList, const list<Envelope>& envelopes)
+MachineCounts::MachineCounts (const EvaluatedMachine& machine, const SeqPairList& seqPairList, const list<Envelope>& envelopes, const DPOptions& options)
 {
   init (machine);
+  const DPPlanner planner (machine, options);
   auto env = envelopes.begin();
-  for (const auto& seqPair: seqPairList.seqPairs)
-    (void) add (machine, seqPair, env == envelopes.end() ? Envelope(seqPair) : *(env++));
+  for (const auto& seqPair: seqPairList.seqPairs) {
+    const Envelope pairEnv = env == envelopes.end() ? Envelope(seqPair) : *(env++);
+    (void) add (machine, seqPair, pairEnv, planner.plan(DPTask::ForwardBackward,pairEnv).variant, options);
+  }
 }
 
 void MachineCounts::init (const EvaluatedMachine& machine) {
@@ -49,16 +55,60 @@ void MachineCounts::init (const EvaluatedMachine& machine) {
     count[s].resize (machine.state[s].nTransitions, 0.);
 }
 
-double MachineCounts::add (const EvaluatedMachine& machine, const SeqPair& seqPair) {
+double MachineCounts::add (const EvaluatedMachine& machine, const SeqPair& seqPair, const DPOptions& options) {
   const Envelope env (seqPair);
-  return add (machine, seqPair, env);
+  return add (machine, seqPair, env, options);
+}
+
+template<class ForwardType,class BackwardType>
+double visitForwardBackward (const EvaluatedMachine& machine, const SeqPair& seqPair, const Envelope& env, const MachineCounts::TransVisitor& visitor, const DPOptions& options) {
+  const ForwardType forward (machine, seqPair, env, options);
+  const BackwardType backward (machine, seqPair, env, options);
+  backward.getCounts (forward, visitor);
+  return forward.logLike();
 }
 
-double MachineCounts::add (const EvaluatedMachine& machine, const SeqPair& seqPair, const Envelope& env) {
-  const ForwardMatrix forward (machine, seqPair, env);
-  const BackwardMatrix backward (machine, seqPair, env);
-  backward.getCounts (forward, *this);
-  const double result = forward.logLike();
+// Probability-space Forward-Backward, falling back to log space if either matrix may have underflowed
+double visitScaledForwardBackward (const EvaluatedMachine& machine, const SeqPair& seqPair, const Envelope& env, const MachineCounts::TransVisitor& visitor, const DPOptions& options) {
+  {
+    const ScaledForwardMatrix forward (machine, seqPair, env, options);
+    const ScaledBackwardMatrix backward (machine, seqPair, env, options);
+    if (!forward.mayHaveUnderflowed() && !backward.mayHaveUnderflowed()) {
+      backward.getCounts (forward, visitor);
+      return forward.logLike();
+    }
+  }
+  DPOptions logOptions (options);
+  logOptions.space = DPSpace::Log;
+  const double ll = MachineCounts::forwardBackward (machine, seqPair, env, visitor, logOptions);
+  if (ll > -numeric_limits<double>::infinity())
+    Warn ("Probability-space Forward-Backward underflowed for sequence pair (%s,%s); recomputed in log space", seqPair.input.name.c_str(), seqPair.output.name.c_str());
+  return ll;
+}
+
+double MachineCounts::forwardBackward (const EvaluatedMachine& machine, const SeqPair& seqPair, const Envelope& env, const TransVisitor& visitor, const DPOptions& options) {
+  return forwardBackward (machine, seqPair, env, visitor, DPPlanner(machine,options).plan(DPTask::ForwardBackward,env).variant, options);
+}
+
+double MachineCounts::forwardBackward (const EvaluatedMachine& machine, const SeqPair& seqPair, const Envelope& env, const TransVisitor& visitor, DPVariant variant, const DPOptions& options) {
+  if (options.space == DPSpace::Prob)
+    return visitScaledForwardBackward (machine, seqPair, env, visitor, options);
+  if (variant == DPVariant::Checkpointed) {
+    CheckpointedForwardMatrix forward (machine, seqPair, env, "Forward", options);
+    const CheckpointedBackwardMatrix backward (machine, seqPair, env, forward, visitor);
+    return forward.logLike();
+  }
+  if (options.cellType == DPCellType::Float)
+    return visitForwardBackward<FloatForwardMatrix,FloatBackwardMatrix> (machine, seqPair, env, visitor, options);
+  return visitForwardBackward<ForwardMatrix,BackwardMatrix> (machine, seqPair, env, visitor, options);
+}
+
+double MachineCounts::add (const EvaluatedMachine& machine, const SeqPair& seqPair, const Envelope& env, const DPOptions& options) {
+  return add (machine, seqPair, env, DPPlanner(machine,options).plan(DPTask::ForwardBackward,env).variant, options);
+}
+
+double MachineCounts::add (const EvaluatedMachine& machine, const SeqPair& seqPair, const Envelope& env, DPVariant variant, const DPOptions& options) {
+  const double result = forwardBackward (machine, seqPair, env, BackwardMatrix::transitionCounter (*this), variant, options);
   loglike += result;
   return result;
 }
@@ -86,22 +136,36 @@ void MachineCounts::writeParamCountsJson (ostream& outs, const Machine& machine,
   outs << "}";
 }
 
+// The weights and derivatives of all transitions, and the parameter values, are compiled into one WeightProgram, and evaluated in one pass.
+// For each transition, the program computes the weight, then the derivative and value of each of its parameters.
 map<string,double> MachineCounts::paramCounts (const Machine& machine, const ParamAssign& prob) const {
-  map<string,double> paramCount;
   Assert (count.size() == machine.state.size(), "Number of states mismatch");
+  vguard<WeightExpr> exprs;
+  vguard<vguard<string> > transParams;
   for (StateIndex s = 0; s < machine.nStates(); ++s) {
-    auto transIter = machine.state[s].trans.begin();
     Assert (count[s].size() == machine.state[s].trans.size(), "State size mismatch");
-    for (auto& c: count[s]) {
-      auto& trans = *(transIter++);
-      const auto transParams = WeightAlgebra::params (trans.weight, ParamDefs());
-      const double w = WeightAlgebra::eval (trans.weight, prob.defs);
-      for (auto& p: transParams) {
-	const auto deriv = WeightAlgebra::deriv (trans.weight, ParamDefs(), p);
-	paramCount[p] += c * WeightAlgebra::eval (deriv, prob.defs) * WeightAlgebra::asDouble (prob.defs.at(p)) / w;
+    for (const auto& trans: machine.state[s].trans) {
+      const auto params = WeightAlgebra::params (trans.weight, ParamDefs());
+      exprs.push_back (trans.weight);
+      for (auto& p: params) {
+	exprs.push_back (WeightAlgebra::deriv (trans.weight, ParamDefs(), p));
+	exprs.push_back (WeightAlgebra::param (p));
       }
+      transParams.push_back (vguard<string> (params.begin(), params.end()));
     }
   }
+  const vguard<double> val = WeightProgram (exprs, prob.defs).run();
+  map<string,double> paramCount;
+  auto valIter = val.begin();
+  auto transParamsIter = transParams.begin();
+  for (StateIndex s = 0; s < machine.nStates(); ++s)
+    for (auto c: count[s]) {
+      const double w = *(valIter++);
+      for (const auto& p: *(transParamsIter++)) {
+	const double d = *(valIter++), pVal = *(valIter++);
+	paramCount[p] += c * d * pVal / w;
+      }
+    }
   return paramCount;
 }
 
@@ -173,6 +237,9 @@ MachineObjective::MachineObjective (const Machine& machine, const MachineCounts&
   for (const auto& p: transformedParam)
     deriv.push_back (WeightAlgebra::deriv (objective, allDefs, p));
 
+  objectiveProgram = WeightProgram (vguard<WeightExpr> (1, objective), allDefs, transformedParam);
+  derivProgram = WeightProgram (deriv, allDefs, transformedParam);
+
   LogThisAt (ObjectiveFunctionLogLevel, toString());
 }
 
@@ -194,11 +261,9 @@ Params gsl_vector_to_params (const gsl_vector *v, const MachineObjective& ml) {
 double gsl_machine_objective (const gsl_vector *v, void *voidML)
 {
   const MachineObjective& ml (*((MachineObjective*)voidML));
-  const Params pv = gsl_vector_to_params (v, ml);
-
-  const double f = WeightAlgebra::eval (ml.objective, pv.defs);
+  const double f = ml.objectiveProgram.run (gsl_vector_to_stl(v)).front();
 
-  LogThisAt (OptimizationParamsLogLevel, JsonLoader<Params>::toJsonString(pv) << endl);
+  LogThisAt (OptimizationParamsLogLevel, JsonLoader<Params>::toJsonString(gsl_vector_to_params (v, ml)) << endl);
   LogThisAt (ObjectiveFunctionLogLevel, "gsl_machine_objective(" << to_string_join(gsl_vector_to_stl(v)) << ") = " << f << endl);
 
   return f;
@@ -207,10 +272,10 @@ double gsl_machine_objective (const gsl_vector *v, void *voidML)
 void gsl_machine_objective_deriv (const gsl_vector *v, void *voidML, gsl_vector *df)
 {
   const MachineObjective& ml (*((MachineObjective*)voidML));
-  const Params pv = gsl_vector_to_params (v, ml);
+  const vguard<double> d = ml.derivProgram.run (gsl_vector_to_stl(v));
 
   for (size_t n = 0; n < ml.transformedParam.size(); ++n)
-    gsl_vector_set (df, n, WeightAlgebra::eval (ml.deriv[n], pv.defs));
+    gsl_vector_set (df, n, d[n]);
 
   const vguard<double> v_stl = gsl_vector_to_stl(v), df_stl = gsl_vector_to_stl(df);
   LogThisAt (ObjectiveFunctionLogLevel, "gsl_machine_objective_deriv(" << to_string_join(v_stl) << ") = (" << to_string_join(df_stl) << ")" << endl);
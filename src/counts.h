@@ -4,6 +4,8 @@
 #include "eval.h"
 #include "seqpair.h"
 #include "constraints.h"
+#include "planner.h"
+#include "weightvm.h"
 
 // E-step
 namespace MachineBoss {
@@ -13,11 +15,17 @@ struct MachineCounts {
   double loglike;
   MachineCounts();
   MachineCounts (const EvaluatedMachine&);
-  MachineCounts (const EvaluatedMachine&, const SeqPair&);
-  MachineCounts (const EvaluatedMachine&, const SeqPairList&, const list<Envelope>& = list<Envelope>());
+  MachineCounts (const EvaluatedMachine&, const SeqPair&, const DPOptions& = DPOptions());
+  MachineCounts (const EvaluatedMachine&, const SeqPairList&, const list<Envelope>& = list<Envelope>(), const DPOptions& = DPOptions());
   void init (const EvaluatedMachine&);
-  double add (const EvaluatedMachine&, const SeqPair&);  // returns log-likelihood
-  double add (const EvaluatedMachine&, const SeqPair&, const Envelope&);  // returns log-likelihood
+  double add (const EvaluatedMachine&, const SeqPair&, const DPOptions& = DPOptions());  // returns log-likelihood
+  double add (const EvaluatedMachine&, const SeqPair&, const Envelope&, const DPOptions& = DPOptions());  // returns log-likelihood
+  double add (const EvaluatedMachine&, const SeqPair&, const Envelope&, DPVariant, const DPOptions& = DPOptions());  // returns log-likelihood
+  // Forward-Backward, choosing the DP matrix type with DPPlanner, as add() does; visits the posterior probability of every transition at every cell.
+  // TransVisitor is the same type as BackwardMatrix::BackTransVisitor.
+  typedef function<void(StateIndex,EvaluatedMachineState::TransIndex,Envelope::InputIndex,Envelope::OutputIndex,double)> TransVisitor;
+  static double forwardBackward (const EvaluatedMachine&, const SeqPair&, const Envelope&, const TransVisitor&, const DPOptions& = DPOptions());  // returns log-likelihood
+  static double forwardBackward (const EvaluatedMachine&, const SeqPair&, const Envelope&, const TransVisitor&, DPVariant, const DPOptions& = DPOptions());  // uses checkpointed DP if the DPPlanner variant is Checkpointed
   MachineCounts& operator+= (const MachineCounts&);
   map<string,double> paramCounts (const Machine&, const ParamAssign&) const;  // expectation of d(logLike)/d(logParam)
   void writeJson (ostream&) const;
@@ -32,6 +40,7 @@ struct MachineObjective {
   ParamDefs constantDefs, paramTransformDefs, allDefs;
   WeightExpr objective;
   vguard<WeightExpr> deriv;
+  WeightProgram objectiveProgram, derivProgram;  // objective and deriv, compiled with allDefs; slots are transformedParam
   MachineObjective (const Machine&, const MachineCounts&, const Constraints&, const Params&);
   Params optimize (const Params& seed) const;
   string toString() const;
@@ -34,42 +34,34 @@ void PrefixTree::Node::fill (const PrefixTree& tree)
     const OutputToken outTok = outPos ? tree.output[outPos-1] : OutputTokenizer::emptyToken();
     for (StateIndex d = 0; d < nStates; ++d) {
       LogThisAt(9,"d="<<d<<": ");
-      const EvaluatedMachineState& state = tree.machine.state[d];
+      const EvaluatedTransTable& incoming = tree.machine.incoming;
       double& ll = seqCell (outPos, d);
-      const EvaluatedMachineState::OutStateTransMap* nonAbsorbing = NULL;
-      const EvaluatedMachineState::OutStateTransMap* absorbing = NULL;
-      if (parent && state.incoming.count (inTok))
-	absorbing = &state.incoming.at (inTok);
-      if (state.incoming.count (InputTokenizer::emptyToken()))
-	nonAbsorbing = &state.incoming.at (InputTokenizer::emptyToken());
-      if (absorbing && outPos)
-	accumulateSeqCell (ll, *absorbing, *parent, outTok, outPos - 1);
-      if (absorbing)
-	accumulateSeqCell (ll, *absorbing, *parent, OutputTokenizer::emptyToken(), outPos);
+      if (parent && outPos)
+	accumulateSeqCell (ll, incoming, d, inTok, *parent, outTok, outPos - 1);
+      if (parent)
+	accumulateSeqCell (ll, incoming, d, inTok, *parent, OutputTokenizer::emptyToken(), outPos);
       prefixCell (outPos, d) = ll;
-      if (outPos && nonAbsorbing)
-	accumulateSeqCell (ll, *nonAbsorbing, *this, outTok, outPos - 1);
-      if (nonAbsorbing)
-	accumulateSeqCell (ll, *nonAbsorbing, *this, OutputTokenizer::emptyToken(), outPos);
+      if (outPos)
+	accumulateSeqCell (ll, incoming, d, InputTokenizer::emptyToken(), *this, outTok, outPos - 1);
+      accumulateSeqCell (ll, incoming, d, InputTokenizer::emptyToken(), *this, OutputTokenizer::emptyToken(), outPos);
       LogThisAt(8,"seqCell("<<outPos<<","<<d<<")="<<ll<<endl);
     }
     // looping over d AND prevState seems inefficient! Could precompute logSumInTrans*outTrans for each outTok
     for (StateIndex d = 0; d < nStates; ++d) {
       double& ll = prefixCell (outPos, d);
       if (outPos) {
-	const EvaluatedMachineState& state = tree.machine.state[d];
-	for (const auto& i_ostm: state.incoming) {
-	  const EvaluatedMachineState::OutStateTransMap& outStateTransMap = i_ostm.second;
-	  if (outStateTransMap.count (outTok))
-	    for (const auto& st: outStateTransMap.at (outTok)) {
-	      const EvaluatedMachineState::Trans& trans = st.second;
-	      for (StateIndex prevState = 0; prevState < nStates; ++prevState) {
-		const double prevCell = prefixCell (outPos - 1, prevState);
-		const double logEmitWeight = prevCell + tree.logSumInTrans[prevState][st.first] + trans.logWeight;
-		log_accum_exp (ll, logEmitWeight);
-		LogThisAt(9,"prefixCell("<<outPos<<","<<d<<") logsum+= "<<prevCell<<" + "<<tree.logSumInTrans[prevState][st.first]<<" + "<<trans.logWeight<<" ("<<prevState<<"->"<<st.first<<"->"<<d<<")"<<" ... now "<<ll<<endl);
-	      }
+	const EvaluatedTransTable& incoming = tree.machine.incoming;
+	for (InputToken tok = 0; tok < incoming.nInToks; ++tok) {
+	  const EvaluatedTransTable::Offset end = incoming.end (d, tok, outTok);
+	  for (EvaluatedTransTable::Offset n = incoming.begin (d, tok, outTok); n < end; ++n) {
+	    const StateIndex src = incoming.state[n];
+	    for (StateIndex prevState = 0; prevState < nStates; ++prevState) {
+	      const double prevCell = prefixCell (outPos - 1, prevState);
+	      const double logEmitWeight = prevCell + tree.logSumInTrans[prevState][src] + incoming.logWeight[n];
+	      log_accum_exp (ll, logEmitWeight);
+	      LogThisAt(9,"prefixCell("<<outPos<<","<<d<<") logsum+= "<<prevCell<<" + "<<tree.logSumInTrans[prevState][src]<<" + "<<incoming.logWeight[n]<<" ("<<prevState<<"->"<<src<<"->"<<d<<")"<<" ... now "<<ll<<endl);
 	    }
+	  }
 	}
       }
       LogThisAt(8,"prefixCell("<<outPos<<","<<d<<")="<<ll<<endl);
@@ -37,13 +37,12 @@ struct PrefixTree {
     void fill (const PrefixTree& tree);
     double logSeqProb() const;
 
-    inline void accumulateSeqCell (double& ll, const EvaluatedMachineState::OutStateTransMap& outStateTransMap, const Node& inNode, OutputToken outTok, OutputIndex outPos) const {
-      if (outStateTransMap.count (outTok))
-	for (const auto& st: outStateTransMap.at (outTok)) {
-	  const EvaluatedMachineState::Trans& trans = st.second;
-	  LogThisAt(9,"seqCell("<<outPos<<",d) logsum+= "<<inNode.seqCell(outPos,st.first)<<" + "<<trans.logWeight<<" ("<<st.first<<"->d)"<<endl);
-	  log_accum_exp (ll, inNode.seqCell(outPos,st.first) + trans.logWeight);
-	}
+    inline void accumulateSeqCell (double& ll, const EvaluatedTransTable& incoming, StateIndex dest, InputToken inTok, const Node& inNode, OutputToken outTok, OutputIndex outPos) const {
+      const EvaluatedTransTable::Offset end = incoming.end (dest, inTok, outTok);
+      for (EvaluatedTransTable::Offset n = incoming.begin (dest, inTok, outTok); n < end; ++n) {
+	LogThisAt(9,"seqCell("<<outPos<<",d) logsum+= "<<inNode.seqCell(outPos,incoming.state[n])<<" + "<<incoming.logWeight[n]<<" ("<<incoming.state[n]<<"->d)"<<endl);
+	log_accum_exp (ll, inNode.seqCell(outPos,incoming.state[n]) + incoming.logWeight[n]);
+      }
     }
 
     inline size_t nCells() const {
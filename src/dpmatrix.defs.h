@@ -1,5 +1,5 @@
-template<class IndexMapper>
-DPMatrix<IndexMapper>::DPMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair) :
+template<class IndexMapper,class Cell>
+DPMatrix<IndexMapper,Cell>::DPMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const DPOptions& options) :
   IndexMapper (seqPair),
   machine (machine),
   seqPair (seqPair),
@@ -7,37 +7,49 @@ DPMatrix<IndexMapper>::DPMatrix (const EvaluatedMachine& machine, const SeqPair&
   output (machine.outputTokenizer.tokenize (seqPair.output.seq)),
   inLen (input.size()),
   outLen (output.size()),
-  nStates (machine.nStates())
+  nStates (machine.nStates()),
+  options (options),
+  pruned (false)
 {
   alloc();
 }
 
-template<class IndexMapper>
-DPMatrix<IndexMapper>::DPMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const Envelope& envelope) :
-  IndexMapper (seqPair),
+template<class IndexMapper,class Cell>
+DPMatrix<IndexMapper,Cell>::DPMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const Envelope& envelope, const DPOptions& options) :
+  IndexMapper (envelope),
   machine (machine),
   seqPair (seqPair),
   input (machine.inputTokenizer.tokenize (seqPair.input.seq)),
   output (machine.outputTokenizer.tokenize (seqPair.output.seq)),
   inLen (input.size()),
   outLen (output.size()),
-  nStates (machine.nStates())
+  nStates (machine.nStates()),
+  options (options),
+  pruned (false)
 {
   alloc();
 }
 
-template<class IndexMapper>
-void DPMatrix<IndexMapper>::alloc() {
+template<class IndexMapper,class Cell>
+void DPMatrix<IndexMapper,Cell>::alloc() {
   Assert (IndexMapper::env.fits(seqPair), "Envelope/sequence mismatch:\n%s\n%s\n", JsonWriter<Envelope>::toJsonString(IndexMapper::env).c_str(), JsonWriter<SeqPair>::toJsonString(seqPair).c_str());
   Assert (IndexMapper::env.connected(), "Envelope is not connected:\n%s\n", JsonWriter<Envelope>::toJsonString(IndexMapper::env).c_str());
   IndexMapper::preAlloc();  // initializes nCells()
   LogThisAt(7,"Creating matrix with " << nCells() << " cells (<=" << (inLen+1) << "*" << (outLen+1) << "*" << nStates << ")" << endl);
   LogThisAt(8,"Machine:" << endl << machine.toJsonString() << endl);
-  cellStorage.resize (nCells(), -numeric_limits<double>::infinity());
+  cellStorage.resize (nCells(), -numeric_limits<Cell>::infinity(), IndexMapper::storesAllCells ? options.scratchDir : string());
+  if (options.local.enabled())
+    terminus.resize (outLen + 1, -numeric_limits<double>::infinity());
+}
+
+template<class IndexMapper,class Cell>
+template<class Semiring>
+double DPMatrix<IndexMapper,Cell>::terminusLogLike() const {
+  return Semiring::reduce (terminus.data(), terminus.size());
 }
 
-template<class IndexMapper>
-void DPMatrix<IndexMapper>::writeJson (ostream& outs) const {
+template<class IndexMapper,class Cell>
+void DPMatrix<IndexMapper,Cell>::writeJson (ostream& outs) const {
   outs << "{" << endl
        << " \"input\": \"" << seqPair.input.name << "\"," << endl
        << " \"output\": \"" << seqPair.output.name << "\"," << endl
@@ -52,38 +64,324 @@ void DPMatrix<IndexMapper>::writeJson (ostream& outs) const {
        << "}" << endl;
 }
 
-template<class IndexMapper>
-ostream& operator<< (ostream& out, const DPMatrix<IndexMapper>& m) {
+template<class IndexMapper,class Cell>
+ostream& operator<< (ostream& out, const DPMatrix<IndexMapper,Cell>& m) {
   m.writeJson (out);
   return out;
 }
 
-template<class IndexMapper>
-MachinePath DPMatrix<IndexMapper>::traceBack (const Machine& m, TransSelector selectTrans) const {
-  return traceBack (m, inLen, outLen, nStates - 1, selectTrans);
+template<class IndexMapper,class Cell>
+template<class Semiring>
+inline void DPMatrix<IndexMapper,Cell>::fillIncomingCell (InputIndex inPos, OutputIndex outPos, StateIndex startState, double* terms) {
+  fillIncomingCell<Semiring> (inPos, outPos, inPos ? input[inPos-1] : InputTokenizer::emptyToken(), outPos ? output[outPos-1] : OutputTokenizer::emptyToken(), startState, terms);
+}
+
+template<class IndexMapper,class Cell>
+template<class Semiring>
+inline void DPMatrix<IndexMapper,Cell>::fillIncomingCell (InputIndex inPos, OutputIndex outPos, InputToken inTok, OutputToken outTok, StateIndex startState, double* terms) {
+  const bool startHere = canStart (inPos, outPos);
+  auto fillState = [&] (StateIndex d) {
+    double* term = terms;
+    if (startHere && d == startState)
+      *(term++) = 0;
+    if (inPos && outPos)
+      gather (term, machine.incoming, d, inTok, outTok, inPos - 1, outPos - 1);
+    if (inPos)
+      gather (term, machine.incoming, d, inTok, OutputTokenizer::emptyToken(), inPos - 1, outPos);
+    if (outPos)
+      gather (term, machine.incoming, d, InputTokenizer::emptyToken(), outTok, inPos, outPos - 1);
+    gather (term, machine.incoming, d, InputTokenizer::emptyToken(), OutputTokenizer::emptyToken(), inPos, outPos);
+    cell(inPos,outPos,d) = Semiring::reduce (terms, term - terms);
+  };
+  if (!inPos && !outPos) {  // the start state may have no incoming transitions, so visit every state
+    for (StateIndex d = 0; d < nStates; ++d)
+      fillState (d);
+  } else {
+    if (!IndexMapper::storesAllCells)  // storage is reused, so reset the states that are skipped
+      for (StateIndex d = 0; d < nStates; ++d)
+	cell(inPos,outPos,d) = -numeric_limits<double>::infinity();
+    if (startHere)  // a local alignment may start here, so fill the start state (which comes first) even if it is inactive
+      fillState (startState);
+    const EvaluatedTransTable& incoming = machine.incoming;
+    const EvaluatedTransTable::Offset end = incoming.activeEnd (inTok, outTok);
+    for (EvaluatedTransTable::Offset n = incoming.activeBegin (inTok, outTok); n < end; ++n)
+      if (!startHere || incoming.activeState[n] != startState)
+	fillState (incoming.activeState[n]);
+  }
+  if (options.local.enabled()) {  // the first cell of each row is always filled first, so resets the row's terminus
+    double& t = terminus[outPos];
+    if (inPos == IndexMapper::env.inStart[outPos])
+      t = -numeric_limits<double>::infinity();
+    if (canEnd (inPos, outPos))
+      t = Semiring::reduce (t, (double) cell(inPos,outPos,machine.endState()));
+  }
+}
+
+template<class IndexMapper,class Cell>
+template<class Semiring>
+inline void DPMatrix<IndexMapper,Cell>::fillOutgoingCell (InputIndex inPos, OutputIndex outPos, StateIndex endState, double* terms) {
+  const bool endOfOutput = (outPos == outLen);
+  const OutputToken outTok = endOfOutput ? OutputTokenizer::emptyToken() : output[outPos];
+  const bool endOfInput = (inPos == inLen);
+  const InputToken inTok = endOfInput ? InputTokenizer::emptyToken() : input[inPos];
+  const bool endHere = canEnd (inPos, outPos);
+  auto fillState = [&] (StateIndex s) {
+    double* term = terms;
+    if (endHere && s == endState)
+      *(term++) = 0;
+    if (!endOfInput && !endOfOutput)
+      gather (term, machine.outgoing, s, inTok, outTok, inPos + 1, outPos + 1);
+    if (!endOfInput)
+      gather (term, machine.outgoing, s, inTok, OutputTokenizer::emptyToken(), inPos + 1, outPos);
+    if (!endOfOutput)
+      gather (term, machine.outgoing, s, InputTokenizer::emptyToken(), outTok, inPos, outPos + 1);
+    gather (term, machine.outgoing, s, InputTokenizer::emptyToken(), OutputTokenizer::emptyToken(), inPos, outPos);
+    cell(inPos,outPos,s) = Semiring::reduce (terms, term - terms);
+  };
+  if (endOfInput && endOfOutput) {  // the end state may have no outgoing transitions, so visit every state
+    for (int s = nStates - 1; s >= 0; --s)
+      fillState ((StateIndex) s);
+  } else {
+    if (!IndexMapper::storesAllCells)  // storage is reused, so reset the states that are skipped
+      for (StateIndex s = 0; s < nStates; ++s)
+	cell(inPos,outPos,s) = -numeric_limits<double>::infinity();
+    if (endHere)  // a local alignment may end here, so fill the end state (which comes last) even if it is inactive
+      fillState (endState);
+    const EvaluatedTransTable& outgoing = machine.outgoing;
+    const EvaluatedTransTable::Offset begin = outgoing.activeBegin (inTok, outTok);
+    for (EvaluatedTransTable::Offset n = outgoing.activeEnd (inTok, outTok); n > begin; --n)
+      if (!endHere || outgoing.activeState[n-1] != endState)
+	fillState (outgoing.activeState[n-1]);
+  }
+  if (options.local.enabled()) {  // the last cell of each row is always filled first, so resets the row's terminus
+    double& t = terminus[outPos];
+    if (inPos == IndexMapper::env.inEnd[outPos] - 1)
+      t = -numeric_limits<double>::infinity();
+    if (canStart (inPos, outPos))
+      t = Semiring::reduce (t, (double) cell(inPos,outPos,machine.startState()));
+  }
+}
+
+template<class IndexMapper,class Cell>
+template<class Semiring>
+void DPMatrix<IndexMapper,Cell>::fillIncoming (StateIndex startState, const char* name) {
+  if (IndexMapper::storesAllCells && options.wavefront.parallel()) {
+    fillWavefront (false, [&] (InputIndex inPos, OutputIndex outPos, double* terms) { fillIncomingCell<Semiring> (inPos, outPos, startState, terms); }, machine.incoming.maxStateTrans + 1, name);
+    return;
+  }
+  ProgressLog(plogDP,6);
+  plogDP.initProgress ("Filling %s matrix (%lu cells)", name, nCellsComputed());
+  vguard<double> terms (machine.incoming.maxStateTrans + 1);
+  CellIndex nCellsDone = 0;
+  for (OutputIndex outPos = 0; outPos <= outLen; ++outPos)
+    for (InputIndex inPos = IndexMapper::env.inStart[outPos]; inPos < IndexMapper::env.inEnd[outPos]; ++inPos) {
+      plogDP.logProgress (nCellsDone / (double) nCellsComputed(), "filled %lu cells", nCellsDone);
+      nCellsDone += nStates;
+      fillIncomingCell<Semiring> (inPos, outPos, startState, terms.data());
+    }
+  LogThisAt(8,name << " matrix:" << endl << *this);
+}
+
+template<class IndexMapper,class Cell>
+template<class Semiring>
+void DPMatrix<IndexMapper,Cell>::fillOutgoing (StateIndex endState, const char* name) {
+  if (IndexMapper::storesAllCells && options.wavefront.parallel()) {
+    fillWavefront (true, [&] (InputIndex inPos, OutputIndex outPos, double* terms) { fillOutgoingCell<Semiring> (inPos, outPos, endState, terms); }, machine.outgoing.maxStateTrans + 1, name);
+    return;
+  }
+  ProgressLog(plogDP,6);
+  plogDP.initProgress ("Filling %s matrix (%lu cells)", name, nCellsComputed());
+  vguard<double> terms (machine.outgoing.maxStateTrans + 1);
+  CellIndex nCellsDone = 0;
+  for (OutputIndex outPos = outLen; outPos >= 0; --outPos)
+    for (InputIndex inPos = IndexMapper::env.inEnd[outPos] - 1; inPos >= IndexMapper::env.inStart[outPos]; --inPos) {
+      plogDP.logProgress (nCellsDone / (double) nCellsComputed(), "filled %lu cells", nCellsDone);
+      nCellsDone += nStates;
+      fillOutgoingCell<Semiring> (inPos, outPos, endState, terms.data());
+    }
+  LogThisAt(8,name << " matrix:" << endl << *this);
+}
+
+// Cells are filled in order of anti-diagonal (inPos+outPos), since cells on the same anti-diagonal have emitted the same number of symbols.
+// Only cells adjacent to an unpruned cell on one of the previous two anti-diagonals are computed;
+// the unpruned cells of each anti-diagonal are kept as a sorted sparse list of input positions.
+// Once an anti-diagonal is filled, cells more than xDrop below its maximum are pruned. The end cell is never pruned.
+// With xDrop infinite, the result is identical to fillIncoming (but unreachable cells are skipped).
+// For matrices that reuse storage, cells computed three anti-diagonals ago are reset before the storage is reused.
+template<class IndexMapper,class Cell>
+template<class Semiring>
+void DPMatrix<IndexMapper,Cell>::fillIncomingPruned (StateIndex startState, double xDrop, const char* name) {
+  const OutputIndex nDiagonals = inLen + outLen + 1;
+  ProgressLog(plogDP,6);
+  plogDP.initProgress ("Filling %s matrix by anti-diagonals with X-drop pruning (%ld anti-diagonals)", name, nDiagonals);
+  vguard<double> terms (machine.incoming.maxStateTrans + 1);
+  vguard<vguard<InputIndex> > active (3), computed (3);  // input positions of unpruned & computed cells on the last three anti-diagonals
+  vguard<InputIndex> candidate;
+  CellIndex nCellsDone = 0;
+  pruned = false;
+  for (OutputIndex diag = 0; diag < nDiagonals; ++diag) {
+    plogDP.logProgress (diag / (double) nDiagonals, "anti-diagonal %ld", diag);
+    vguard<InputIndex>& diagComputed = computed[diag % 3];
+    vguard<InputIndex>& diagActive = active[diag % 3];
+    if (!IndexMapper::storesAllCells)
+      for (auto inPos: diagComputed)
+	for (StateIndex s = 0; s < nStates; ++s)
+	  cell (inPos, diag - 3 - inPos, s) = -numeric_limits<double>::infinity();
+    diagComputed.clear();
+    diagActive.clear();
+
+    candidate.clear();
+    if (diag == 0)
+      candidate.push_back (0);
+    for (auto inPos: active[(diag + 2) % 3]) {
+      candidate.push_back (inPos);
+      candidate.push_back (inPos + 1);
+    }
+    for (auto inPos: active[(diag + 1) % 3])
+      candidate.push_back (inPos + 1);
+    sort (candidate.begin(), candidate.end());
+    candidate.erase (unique (candidate.begin(), candidate.end()), candidate.end());
+
+    double diagMax = -numeric_limits<double>::infinity();
+    for (auto inPos: candidate) {
+      const OutputIndex outPos = diag - inPos;
+      if (inPos > inLen || outPos < 0 || outPos > outLen || !IndexMapper::env.contains (inPos, outPos))
+	continue;
+      fillIncomingCell<Semiring> (inPos, outPos, startState, terms.data());
+      diagComputed.push_back (inPos);
+      nCellsDone += nStates;
+      for (StateIndex s = 0; s < nStates; ++s)
+	diagMax = max (diagMax, (double) cell (inPos, outPos, s));
+    }
+
+    const double threshold = diagMax - xDrop;
+    for (auto inPos: diagComputed) {
+      const OutputIndex outPos = diag - inPos;
+      const bool isEnd = (inPos == inLen && outPos == outLen);
+      bool isActive = false;
+      for (StateIndex s = 0; s < nStates; ++s) {
+	Cell& c = cell (inPos, outPos, s);
+	if (c < threshold && !isEnd) {
+	  if (c > -numeric_limits<Cell>::infinity())
+	    pruned = true;
+	  c = -numeric_limits<Cell>::infinity();
+	} else if (c > -numeric_limits<Cell>::infinity())
+	  isActive = true;
+      }
+      if (isActive)
+	diagActive.push_back (inPos);
+    }
+  }
+  LogThisAt(6,"Pruned " << name << " fill computed " << nCellsDone << " of " << nCellsComputed() << " cells" << endl);
+  LogThisAt(8,name << " matrix:" << endl << *this);
+}
+
+// Each cell depends only on cells at the same or lower (inPos,outPos) (for a forward fill; the reverse for a backward fill),
+// so a tile depends only on its three neighbors on the previous tile anti-diagonal.
+// Within a tile, cells are visited in the same order as the serial fill, so results are bit-identical.
+// The threads are started once per fill, with a barrier between tile diagonals; there are never more threads than tiles on the longest diagonal.
+template<class IndexMapper,class Cell>
+template<class CellFiller>
+void DPMatrix<IndexMapper,Cell>::fillWavefront (bool reverse, CellFiller fillCell, size_t nTerms, const char* name) {
+  const long tile = max ((long) 1, (long) options.wavefront.tileSize);
+  const long inTiles = inLen / tile + 1, outTiles = outLen / tile + 1, nDiagonals = inTiles + outTiles - 1;
+  const size_t nThreads = min (options.wavefront.threads, (size_t) min (inTiles, outTiles));
+  WorkStealingPool pool (nThreads);
+  ProgressLog(plogDP,6);
+  plogDP.initProgress ("Filling %s matrix (%lu cells) using %lu threads", name, nCellsComputed(), nThreads);
+  auto diagonal = [&] (WorkStealingPool::PhaseIndex k) {
+    return reverse ? (nDiagonals - 1 - (long) k) : (long) k;
+  };
+  auto outTileMin = [&] (long diag) { return max (0L, diag - inTiles + 1); };
+  auto outTileMax = [&] (long diag) { return min (diag, outTiles - 1); };
+  pool.runPhases (nDiagonals,
+		  [&] (WorkStealingPool::PhaseIndex k) {
+		    const long diag = diagonal (k);
+		    return (WorkStealingPool::TaskIndex) (outTileMax (diag) + 1 - outTileMin (diag));
+		  },
+		  [&] (WorkStealingPool::PhaseIndex k, WorkStealingPool::TaskIndex n) {
+	if (n == 0)  // one task per diagonal
+	  plogDP.logProgress (k / (double) nDiagonals, "filled %ld/%ld tile diagonals", (long) k, nDiagonals);
+	const long diag = diagonal (k), outTile = outTileMin (diag) + n, inTile = diag - outTile;
+	const OutputIndex outBegin = outTile * tile, outEnd = min (outBegin + tile, (OutputIndex) outLen + 1);
+	const InputIndex inBegin = inTile * tile, inEnd = min (inBegin + tile, (InputIndex) inLen + 1);
+	vguard<double> terms (nTerms);
+	if (reverse) {
+	  for (OutputIndex outPos = outEnd - 1; outPos >= outBegin; --outPos)
+	    for (InputIndex inPos = min (inEnd, IndexMapper::env.inEnd[outPos]) - 1; inPos >= max (inBegin, IndexMapper::env.inStart[outPos]); --inPos)
+	      fillCell (inPos, outPos, terms.data());
+	} else {
+	  for (OutputIndex outPos = outBegin; outPos < outEnd; ++outPos)
+	    for (InputIndex inPos = max (inBegin, IndexMapper::env.inStart[outPos]); inPos < min (inEnd, IndexMapper::env.inEnd[outPos]); ++inPos)
+	      fillCell (inPos, outPos, terms.data());
+	}
+      });
+  LogThisAt(8,name << " matrix:" << endl << *this);
+}
+
+template<class IndexMapper,class Cell>
+void DPMatrix<IndexMapper,Cell>::selectTerminus (bool pathStart, OutputIndex outBegin, OutputIndex outEnd, InputIndex& inPos, OutputIndex& outPos, TransSelector selectTrans) const {
+  const StateIndex s = pathStart ? machine.startState() : machine.endState();
+  vguard<double> loglike;
+  vguard<InputIndex> cellInPos;
+  vguard<OutputIndex> cellOutPos;
+  for (OutputIndex o = outBegin; o <= outEnd; ++o)
+    for (InputIndex i = IndexMapper::env.inStart[o]; i < IndexMapper::env.inEnd[o]; ++i)
+      if (pathStart ? canStart(i,o) : canEnd(i,o)) {
+	loglike.push_back (cell(i,o,s));
+	cellInPos.push_back (i);
+	cellOutPos.push_back (o);
+      }
+  Assert (loglike.size(), "No cells at which a local alignment can %s", pathStart ? "start" : "end");
+  const size_t n = selectTrans (loglike);
+  inPos = cellInPos[n];
+  outPos = cellOutPos[n];
+}
+
+template<class IndexMapper,class Cell>
+MachinePath DPMatrix<IndexMapper,Cell>::traceBack (const Machine& m, TransSelector selectTrans) const {
+  InputIndex inStart;
+  OutputIndex outStart;
+  return traceBack (m, inStart, outStart, selectTrans);
+}
+
+template<class IndexMapper,class Cell>
+MachinePath DPMatrix<IndexMapper,Cell>::traceBack (const Machine& m, InputIndex& inStart, OutputIndex& outStart, TransSelector selectTrans) const {
+  inStart = inLen;
+  outStart = outLen;
+  if (options.local.enabled())
+    selectTerminus (false, 0, outLen, inStart, outStart, selectTrans);
+  MachinePath path;
+  TraceTerminator stopTrace = [&] (InputIndex inPos, OutputIndex outPos, StateIndex s, EvaluatedMachineState::TransIndex ti) {
+    path.trans.push_front (m.state[s].getTransition (ti));
+    inStart = inPos;
+    outStart = outPos;
+    return false;
+  };
+  traceBack (m, inStart, outStart, nStates - 1, stopTrace, selectTrans);
+  return path;
 }
 
-template<class IndexMapper>
-MachinePath DPMatrix<IndexMapper>::traceBack (const Machine& m, StateIndex s, TransSelector selectTrans) const {
+template<class IndexMapper,class Cell>
+MachinePath DPMatrix<IndexMapper,Cell>::traceBack (const Machine& m, StateIndex s, TransSelector selectTrans) const {
   return traceBack (m, inLen, outLen, s, selectTrans);
 }
 
-template<class IndexMapper>
-MachinePath DPMatrix<IndexMapper>::traceBack (const Machine& m, InputIndex inPos, OutputIndex outPos, StateIndex s, TransSelector selectTrans) const {
+template<class IndexMapper,class Cell>
+MachinePath DPMatrix<IndexMapper,Cell>::traceBack (const Machine& m, InputIndex inPos, OutputIndex outPos, StateIndex s, TransSelector selectTrans) const {
   MachinePath path;
   TraceTerminator stopTrace = [&] (InputIndex inPos, OutputIndex outPos, StateIndex s, EvaluatedMachineState::TransIndex ti) {
     path.trans.push_front (m.state[s].getTransition (ti));
     return false;
   };
-  traceBack (m, inLen, outLen, s, stopTrace, selectTrans);
+  traceBack (m, inPos, outPos, s, stopTrace, selectTrans);
   return path;
 }
 
-template<class IndexMapper>
-void DPMatrix<IndexMapper>::traceBack (const Machine& m, InputIndex inPos, OutputIndex outPos, StateIndex s, TraceTerminator stopTrace, TransSelector selectTrans) const {
+template<class IndexMapper,class Cell>
+bool DPMatrix<IndexMapper,Cell>::traceBack (const Machine& m, InputIndex inPos, OutputIndex outPos, StateIndex s, TraceTerminator stopTrace, TransSelector selectTrans) const {
   Assert (cell(inPos,outPos,s) > -numeric_limits<double>::infinity(), "Can't do traceback: no finite-weight paths");
   while (inPos > 0 || outPos > 0 || s != 0) {
-    const EvaluatedMachineState& state = machine.state[s];
     vguard<double> loglike;
     vguard<StateIndex> source;
     vguard<EvaluatedMachineState::TransIndex> transIndex;
@@ -91,13 +389,17 @@ void DPMatrix<IndexMapper>::traceBack (const Machine& m, InputIndex inPos, Outpu
     const InputToken inTok = inPos ? input[inPos-1] : InputTokenizer::emptyToken();
     const OutputToken outTok = outPos ? output[outPos-1] : OutputTokenizer::emptyToken();
     if (inPos && outPos)
-      pathIterate (tv, state.incoming, inTok, outTok, inPos - 1, outPos - 1);
+      pathIterate (tv, machine.incoming, s, inTok, outTok, inPos - 1, outPos - 1);
     if (inPos)
-      pathIterate (tv, state.incoming, inTok, OutputTokenizer::emptyToken(), inPos - 1, outPos);
+      pathIterate (tv, machine.incoming, s, inTok, OutputTokenizer::emptyToken(), inPos - 1, outPos);
     if (outPos)
-      pathIterate (tv, state.incoming, InputTokenizer::emptyToken(), outTok, inPos, outPos - 1);
-    pathIterate (tv, state.incoming, InputTokenizer::emptyToken(), OutputTokenizer::emptyToken(), inPos, outPos);
+      pathIterate (tv, machine.incoming, s, InputTokenizer::emptyToken(), outTok, inPos, outPos - 1);
+    pathIterate (tv, machine.incoming, s, InputTokenizer::emptyToken(), OutputTokenizer::emptyToken(), inPos, outPos);
+    if (s == machine.startState() && canStart (inPos, outPos))  // the option of starting a local alignment here
+      loglike.push_back (0);
     const size_t best = selectTrans (loglike);
+    if (best == source.size())
+      return true;
     const auto bestSource = source[best];
     const auto bestTransIndex = transIndex[best];
     const MachineTransition& bestTrans = m.state[bestSource].getTransition (bestTransIndex);
@@ -105,31 +407,35 @@ void DPMatrix<IndexMapper>::traceBack (const Machine& m, InputIndex inPos, Outpu
     if (!bestTrans.outputEmpty()) --outPos;
     s = bestSource;
     if (stopTrace (inPos, outPos, s, bestTransIndex))
-      break;
+      return false;
   }
+  return true;
 }
 
-template<class IndexMapper>
-MachinePath DPMatrix<IndexMapper>::traceForward (const Machine& m, TransSelector selectTrans) const {
-  return traceBack (m, 0, 0, 0, selectTrans);
+template<class IndexMapper,class Cell>
+MachinePath DPMatrix<IndexMapper,Cell>::traceForward (const Machine& m, TransSelector selectTrans) const {
+  InputIndex inPos = 0;
+  OutputIndex outPos = 0;
+  if (options.local.enabled())
+    selectTerminus (true, 0, outLen, inPos, outPos, selectTrans);
+  return traceForward (m, inPos, outPos, 0, selectTrans);
 }
 
-template<class IndexMapper>
-MachinePath DPMatrix<IndexMapper>::traceForward (const Machine& m, InputIndex inPos, OutputIndex outPos, StateIndex s, TransSelector selectTrans) const {
+template<class IndexMapper,class Cell>
+MachinePath DPMatrix<IndexMapper,Cell>::traceForward (const Machine& m, InputIndex inPos, OutputIndex outPos, StateIndex s, TransSelector selectTrans) const {
   MachinePath path;
   TraceTerminator stopTrace = [&] (InputIndex inPos, OutputIndex outPos, StateIndex s, EvaluatedMachineState::TransIndex ti) {
     path.trans.push_back (m.state[s].getTransition (ti));
     return false;
   };
-  traceForward (m, inLen, outLen, s, stopTrace, selectTrans);
+  traceForward (m, inPos, outPos, s, stopTrace, selectTrans);
   return path;
 }
 
-template<class IndexMapper>
-void DPMatrix<IndexMapper>::traceForward (const Machine& m, InputIndex inPos, OutputIndex outPos, StateIndex s, TraceTerminator stopTrace, TransSelector selectTrans) const {
+template<class IndexMapper,class Cell>
+bool DPMatrix<IndexMapper,Cell>::traceForward (const Machine& m, InputIndex inPos, OutputIndex outPos, StateIndex s, TraceTerminator stopTrace, TransSelector selectTrans) const {
   Assert (cell(inPos,outPos,s) > -numeric_limits<double>::infinity(), "Can't do traceforward: no finite-weight paths");
   while (inPos < inLen || outPos < outLen || s != nStates - 1) {
-    const EvaluatedMachineState& state = machine.state[s];
     vguard<double> loglike;
     vguard<StateIndex> dest;
     vguard<EvaluatedMachineState::TransIndex> transIndex;
@@ -139,27 +445,32 @@ void DPMatrix<IndexMapper>::traceForward (const Machine& m, InputIndex inPos, Ou
     const InputToken inTok = endOfInput ? InputTokenizer::emptyToken() : input[inPos];
     const OutputToken outTok = endOfOutput ? OutputTokenizer::emptyToken() : output[outPos];
     if (!endOfInput && !endOfOutput)
-      pathIterate (tv, state.outgoing, inTok, outTok, inPos + 1, outPos + 1);
+      pathIterate (tv, machine.outgoing, s, inTok, outTok, inPos + 1, outPos + 1);
     if (!endOfInput)
-      pathIterate (tv, state.outgoing, inTok, OutputTokenizer::emptyToken(), inPos + 1, outPos);
+      pathIterate (tv, machine.outgoing, s, inTok, OutputTokenizer::emptyToken(), inPos + 1, outPos);
     if (!endOfOutput)
-      pathIterate (tv, state.outgoing, InputTokenizer::emptyToken(), outTok, inPos, outPos + 1);
-    pathIterate (tv, state.outgoing, InputTokenizer::emptyToken(), OutputTokenizer::emptyToken(), inPos, outPos);
+      pathIterate (tv, machine.outgoing, s, InputTokenizer::emptyToken(), outTok, inPos, outPos + 1);
+    pathIterate (tv, machine.outgoing, s, InputTokenizer::emptyToken(), OutputTokenizer::emptyToken(), inPos, outPos);
+    if (s == machine.endState() && canEnd (inPos, outPos))  // the option of ending a local alignment here
+      loglike.push_back (0);
     const size_t best = selectTrans (loglike);
+    if (best == dest.size())
+      return true;
     const auto bestDest = dest[best];
     const auto bestTransIndex = transIndex[best];
     if (stopTrace (inPos, outPos, s, bestTransIndex))
-      break;
+      return false;
     const MachineTransition& bestTrans = m.state[s].getTransition (bestTransIndex);
     Assert (bestTrans.dest == bestDest, "Traceforward error");
     if (!bestTrans.inputEmpty()) ++inPos;
     if (!bestTrans.outputEmpty()) ++outPos;
     s = bestDest;
   }
+  return true;
 }
 
-template<class IndexMapper>
-typename DPMatrix<IndexMapper>::TransVisitor DPMatrix<IndexMapper>::addTransToTraceOptions (vguard<StateIndex>& state, vguard<EvaluatedMachineState::TransIndex>& transIndex, vguard<double>& loglike) {
+template<class IndexMapper,class Cell>
+typename DPMatrix<IndexMapper,Cell>::TransVisitor DPMatrix<IndexMapper,Cell>::addTransToTraceOptions (vguard<StateIndex>& state, vguard<EvaluatedMachineState::TransIndex>& transIndex, vguard<double>& loglike) {
   TransVisitor visit = [&] (StateIndex s, EvaluatedMachineState::TransIndex ti, double tll) {
     state.push_back (s);
     transIndex.push_back (ti);
@@ -168,13 +479,13 @@ typename DPMatrix<IndexMapper>::TransVisitor DPMatrix<IndexMapper>::addTransToTr
   return visit;
 }
 
-template<class IndexMapper>
-size_t DPMatrix<IndexMapper>::selectMaxTrans (const vguard<double>& logWeights) {
+template<class IndexMapper,class Cell>
+size_t DPMatrix<IndexMapper,Cell>::selectMaxTrans (const vguard<double>& logWeights) {
   return distance (logWeights.begin(), max_element (logWeights.begin(), logWeights.end()));
 }
 
-template<class IndexMapper>
-typename DPMatrix<IndexMapper>::TransSelector DPMatrix<IndexMapper>::randomTransSelector (mt19937& rng) {
+template<class IndexMapper,class Cell>
+typename DPMatrix<IndexMapper,Cell>::TransSelector DPMatrix<IndexMapper,Cell>::randomTransSelector (mt19937& rng) {
   TransSelector selector = [&] (const vguard<double>& logWeights) -> size_t {
     vguard<double> weights;
     weights.reserve (logWeights.size());
@@ -185,3 +496,60 @@ typename DPMatrix<IndexMapper>::TransSelector DPMatrix<IndexMapper>::randomTrans
   return selector;
 }
 
+
+template<class Semiring>
+CheckpointedDPMatrix<Semiring>::CheckpointedDPMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const Envelope& env, const char* name, const DPOptions& options) :
+  DPMatrix<BlockOutputIndexMapper> (machine, seqPair, env, options),
+  terms (machine.incoming.maxStateTrans + 1)
+{
+  const OutputIndex nCheckpoints = outLen / blockSize + 1;
+  LogThisAt(6,"Filling checkpointed " << name << " matrix with " << nCheckpoints << " checkpoints, one every " << blockSize << " output rows" << endl);
+  checkpoint.resize (nCheckpoints);
+  ProgressLog(plogDP,6);
+  plogDP.initProgress ("Filling checkpointed %s matrix (%ld rows)", name, outLen + 1);
+  for (OutputIndex n = 0; n < nCheckpoints; ++n) {
+    plogDP.logProgress (n / (double) nCheckpoints, "filled %ld rows", n * blockSize);
+    fillBlock (n * blockSize);
+    if (n == 0)
+      saveRow (0);
+    if (n + 1 < nCheckpoints)
+      saveRow ((n + 1) * blockSize);
+  }
+  endLogLike = options.local.enabled() ? terminusLogLike<Semiring>() : cell (inLen, outLen, machine.endState());
+}
+
+template<class Semiring>
+void CheckpointedDPMatrix<Semiring>::saveRow (OutputIndex outPos) {
+  vguard<double>& row = checkpoint[outPos / blockSize];
+  row.clear();
+  row.reserve ((env.inEnd[outPos] - env.inStart[outPos]) * nStates);
+  for (InputIndex inPos = env.inStart[outPos]; inPos < env.inEnd[outPos]; ++inPos)
+    for (StateIndex s = 0; s < nStates; ++s)
+      row.push_back (cell (inPos, outPos, s));
+}
+
+template<class Semiring>
+void CheckpointedDPMatrix<Semiring>::loadRow (OutputIndex outPos) {
+  vguard<double>::const_iterator iter = checkpoint[outPos / blockSize].begin();
+  for (InputIndex inPos = env.inStart[outPos]; inPos < env.inEnd[outPos]; ++inPos)
+    for (StateIndex s = 0; s < nStates; ++s)
+      cell (inPos, outPos, s) = *(iter++);
+}
+
+template<class Semiring>
+void CheckpointedDPMatrix<Semiring>::fillBlock (OutputIndex blockBegin) {
+  outBegin = blockBegin;
+  const OutputIndex blockEnd = min (blockBegin + blockSize, outLen);
+  for (OutputIndex outPos = blockBegin; outPos <= blockEnd; ++outPos)
+    if (outPos > 0 && outPos == blockBegin)
+      loadRow (outPos);
+    else
+      for (InputIndex inPos = env.inStart[outPos]; inPos < env.inEnd[outPos]; ++inPos)
+	fillIncomingCell<Semiring> (inPos, outPos, machine.startState(), terms.data());
+}
+
+template<class Semiring>
+void CheckpointedDPMatrix<Semiring>::loadBlock (OutputIndex outPos) {
+  if (blockBegin (outPos) != outBegin)
+    fillBlock (blockBegin (outPos));
+}
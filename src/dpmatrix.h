@@ -9,13 +9,70 @@
 #include "seqpair.h"
 #include "logsumexp.h"
 #include "logger.h"
+#include "threadpool.h"
+#include "cellstore.h"
+
+#define DefaultWavefrontTileSize 256
 
 namespace MachineBoss {
 
+// Opt-in wavefront parallelism for filling a single DP matrix.
+// The (inPos,outPos) plane is cut into square tiles; tiles on the same anti-diagonal are independent, and are filled concurrently.
+// Only used for matrices that store every cell (i.e. not RollingOutputIndexMapper).
+struct WavefrontSettings {
+  size_t threads;  // threads per matrix fill; 1 means fill serially
+  size_t tileSize;  // tile width & height, in cells
+  WavefrontSettings() : threads(1), tileSize(DefaultWavefrontTileSize) { }
+  inline bool parallel() const { return threads > 1; }
+};
+
+// X-drop pruning for Forward and Viterbi fills.
+// A cell is pruned (set to -infinity) if it is more than xDrop below the best cell on its anti-diagonal (inPos+outPos).
+// Only neighbours of unpruned cells are computed.
+// Pruning can only remove paths, so the pruned log-likelihood is a lower bound on the true one.
+struct PruningSettings {
+  double xDrop;
+  PruningSettings() : xDrop(numeric_limits<double>::infinity()) { }
+  PruningSettings (double xDrop) : xDrop(xDrop) { }
+  inline bool enabled() const { return xDrop < numeric_limits<double>::infinity(); }
+};
+
+// Local alignment: free start and end positions in the input and/or output sequence.
+// With localInput, a path may start (in the start state) and end (in the end state) at any input position, at no cost; likewise for localOutput.
+// Likelihoods are the same as those of the machine flanked by --flank-input-wild, --flank-output-wild or --flank-both-wild,
+// but the flanking states are never added to the DP. Not used by probability-space, batched, incremental or X-drop pruned fills.
+struct LocalAlignmentSettings {
+  bool localInput, localOutput;
+  LocalAlignmentSettings() : localInput(false), localOutput(false) { }
+  inline bool enabled() const { return localInput || localOutput; }
+};
+
+// Arithmetic used for Forward-Backward: log-space (the default), or rescaled probability-space (see scaled.h)
+enum class DPSpace { Log, Prob };
+
+// Storage type for the cells of full DP matrices used by --counts, --train and --align.
+// Cells are always computed in double precision; Float halves the memory (and bandwidth) needed to store them.
+enum class DPCellType { Double, Float };
+
+#define DefaultMaxDPMemoryMegabytes 4096
+
+// Options for DP matrices, DPPlanner (planner.h) and MachineCounts (counts.h).
+// Each matrix keeps its own copy, so matrices with different options can be used side by side.
+struct DPOptions {
+  WavefrontSettings wavefront;
+  DPSpace space;  // used by DPPlanner and MachineCounts to choose between log-space and scaled probability-space matrices
+  DPCellType cellType;  // used by DPPlanner and MachineCounts to choose between double- and single-precision matrices
+  size_t maxMemory;  // memory budget for DP matrices, in bytes, shared by sequence pairs that are processed concurrently; DPPlanner uses this to choose between full and checkpointed DP
+  string scratchDir;  // if nonempty, matrices that store every cell keep them in a memory-mapped file in this directory (see CellStorage)
+  LocalAlignmentSettings local;
+  DPOptions() : space(DPSpace::Log), cellType(DPCellType::Double), maxMemory((size_t) DefaultMaxDPMemoryMegabytes << 20) { }
+};
+
 struct IndexMapperBase {
   typedef typename Envelope::InputIndex InputIndex;
   typedef typename Envelope::OutputIndex OutputIndex;
   typedef typename Envelope::Offset CellIndex;
+  static const bool diagonalOrder = false;  // if true, the matrix must be filled by anti-diagonals (DPMatrix::fillIncomingPruned)
   const Envelope env;
   vguard<CellIndex> offsets;
   IndexMapperBase (const Envelope& e) :
@@ -24,12 +81,16 @@ struct IndexMapperBase {
   void preAlloc() {
     offsets = env.offsets();
   }
+  inline bool contains (InputIndex inPos, OutputIndex outPos) const {
+    return env.contains (inPos, outPos);
+  }
   inline CellIndex nSuperCellsComputed() const {
     return offsets.back();
   }
 };
 
 struct IdentityIndexMapper : IndexMapperBase {
+  static const bool storesAllCells = true;
   IdentityIndexMapper (const Envelope& e) :
     IndexMapperBase (e)
   { }
@@ -42,6 +103,7 @@ struct IdentityIndexMapper : IndexMapperBase {
 };
 
 struct RollingOutputIndexMapper : IndexMapperBase {
+  static const bool storesAllCells = false;
   const InputIndex inSuperCells;
   RollingOutputIndexMapper (const Envelope& e) :
     IndexMapperBase (e),
@@ -55,13 +117,81 @@ struct RollingOutputIndexMapper : IndexMapperBase {
   }
 };
 
-template<class IndexMapper>
+// Two rolling output rows, for an output sequence that is appended as it arrives, so its length is not known in advance.
+// The envelope has the whole input but no output; every row is treated as spanning the whole input.
+struct StreamingOutputIndexMapper : RollingOutputIndexMapper {
+  StreamingOutputIndexMapper (const Envelope& e) :
+    RollingOutputIndexMapper (e)
+  { }
+  inline bool contains (InputIndex inPos, OutputIndex outPos) const {
+    return inPos >= 0 && inPos < inSuperCells && outPos >= 0;
+  }
+};
+
+// Stores the last three anti-diagonals (inPos+outPos), for score-only fills in anti-diagonal order.
+struct RollingDiagonalIndexMapper : IndexMapperBase {
+  static const bool storesAllCells = false;
+  static const bool diagonalOrder = true;
+  const InputIndex inSuperCells;
+  RollingDiagonalIndexMapper (const Envelope& e) :
+    IndexMapperBase (e),
+    inSuperCells (e.inLen + 1)
+  { }
+  inline CellIndex nSuperCells() const {
+    return 3 * inSuperCells;
+  }
+  inline CellIndex superCellIndex (InputIndex inPos, OutputIndex outPos) const {
+    return ((inPos + outPos) % 3) * inSuperCells + inPos;
+  }
+};
+
+// Stores one block of consecutive output rows [outBegin,outBegin+blockSize], for checkpointed (divide-and-conquer) DP.
+// The block size is ~sqrt(outLen), so one block plus a checkpoint row every blockSize rows is O(sqrt(outLen)) rows.
+// Only cells in the current block may be accessed. See CheckpointedDPMatrix.
+struct BlockOutputIndexMapper : IndexMapperBase {
+  static const bool storesAllCells = false;
+  const InputIndex inSuperCells;
+  const OutputIndex blockSize;
+  OutputIndex outBegin;
+  BlockOutputIndexMapper (const Envelope& e) :
+    IndexMapperBase (e),
+    inSuperCells (e.inLen + 1),
+    blockSize (max ((OutputIndex) 1, (OutputIndex) ceil (sqrt ((double) e.outLen)))),
+    outBegin (0)
+  { }
+  inline CellIndex nSuperCells() const {
+    return (blockSize + 1) * inSuperCells;
+  }
+  inline CellIndex superCellIndex (InputIndex inPos, OutputIndex outPos) const {
+    return (outPos - outBegin) * inSuperCells + inPos;
+  }
+};
+
+// Semirings for the DP fill kernels.
+// These are passed as template parameters, so the reduction can be inlined into the inner loop.
+// The array form of reduce() is used by the fills, which gather all the terms for a cell before reducing them.
+struct LogSumSemiring {
+  static inline double reduce (double x, double y) { return log_sum_exp(x,y); }
+  static inline double reduce (const double* x, size_t n) { return log_sum_exp_array(x,n); }
+};
+
+struct MaxSemiring {
+  static inline double reduce (double x, double y) { return max(x,y); }
+  static inline double reduce (const double* x, size_t n) {
+    double m = -numeric_limits<double>::infinity();
+    for (size_t i = 0; i < n; ++i)
+      m = max (m, x[i]);
+    return m;
+  }
+};
+
+// Cell is the storage type for cells (double or float); all arithmetic is done in double precision.
+template<class IndexMapper, class Cell = double>
 class DPMatrix : protected IndexMapper {
 public:
   typedef typename IndexMapper::InputIndex InputIndex;
   typedef typename IndexMapper::OutputIndex OutputIndex;
 
-  typedef function<double(double,double)> Reducer;
   typedef function<bool(InputIndex,OutputIndex,StateIndex,EvaluatedMachineState::TransIndex)> TraceTerminator;
   typedef function<void(StateIndex,EvaluatedMachineState::TransIndex,double)> TransVisitor;
   typedef function<size_t(const vguard<double>&)> TransSelector;
@@ -78,11 +208,11 @@ protected:
   }
 
 private:
-  vguard<double> cellStorage;
+  CellStorage<Cell> cellStorage;
 
   inline CellIndex cellIndex (InputIndex inPos, OutputIndex outPos, StateIndex state) const {
 #ifdef USE_VECTOR_GUARDS
-    if (!IndexMapper::env.contains (inPos, outPos))
+    if (!IndexMapper::contains (inPos, outPos))
       throw runtime_error ("Envelope out-of-bounds access error");
 #endif
     return IndexMapper::superCellIndex (inPos, outPos) * nStates + state;
@@ -91,28 +221,42 @@ private:
   void alloc();
   
 protected:
-  inline void accumulate (double& ll, const EvaluatedMachineState::InOutStateTransMap& inOutStateTransMap, InputToken inTok, OutputToken outTok, InputIndex inPos, OutputIndex outPos, Reducer reduce) const {
-    auto visit = [&] (StateIndex, EvaluatedMachineState::TransIndex, double t) { ll = reduce(ll,t); };
-    iterate (inOutStateTransMap, inTok, outTok, inPos, outPos, visit);
+  vguard<double> terminus;  // for local alignment: terminus[outPos] = reduction over cells in row outPos at which a path may end (incoming fills) or start (outgoing fills)
+
+  inline void gather (double*& term, const EvaluatedTransTable& transTable, StateIndex s, InputToken inTok, OutputToken outTok, InputIndex inPos, OutputIndex outPos) const {
+    const EvaluatedTransTable::Offset end = transTable.end (s, inTok, outTok);
+    for (EvaluatedTransTable::Offset n = transTable.begin (s, inTok, outTok); n < end; ++n)
+      *(term++) = cell(inPos,outPos,transTable.state[n]) + transTable.logWeight[n];
   }
 
-  inline void iterate (const EvaluatedMachineState::InOutStateTransMap& inOutStateTransMap, InputToken inTok, OutputToken outTok, InputIndex inPos, OutputIndex outPos, TransVisitor visit) const {
-    if (inOutStateTransMap.count (inTok)) {
-      const EvaluatedMachineState::OutStateTransMap& outStateTransMap = inOutStateTransMap.at (inTok);
-      if (outStateTransMap.count (outTok))
-	for (const auto& st: outStateTransMap.at (outTok)) {
-	  const EvaluatedMachineState::Trans& trans = st.second;
-	  visit (st.first, trans.transIndex, cell(inPos,outPos,st.first) + trans.logWeight);
-	}
-    }
+  template<class Visitor>
+  inline void iterate (const EvaluatedTransTable& transTable, StateIndex s, InputToken inTok, OutputToken outTok, InputIndex inPos, OutputIndex outPos, Visitor& visit) const {
+    const EvaluatedTransTable::Offset end = transTable.end (s, inTok, outTok);
+    for (EvaluatedTransTable::Offset n = transTable.begin (s, inTok, outTok); n < end; ++n)
+      visit (transTable.state[n], transTable.transIndex[n], cell(inPos,outPos,transTable.state[n]) + transTable.logWeight[n]);
   }
   
-  inline void pathIterate (TransVisitor visit, const EvaluatedMachineState::InOutStateTransMap& inOutStateTransMap, InputToken inTok, OutputToken outTok, InputIndex inPos, OutputIndex outPos) const {
-    iterate (inOutStateTransMap, inTok, outTok, inPos, outPos, visit);
+  inline bool canStart (InputIndex inPos, OutputIndex outPos) const {
+    return (!inPos || options.local.localInput) && (!outPos || options.local.localOutput);
+  }
+  inline bool canEnd (InputIndex inPos, OutputIndex outPos) const {
+    return (inPos == inLen || options.local.localInput) && (outPos == outLen || options.local.localOutput);
+  }
+  template<class Semiring> double terminusLogLike() const;  // reduction over terminus, for local alignment
+  void selectTerminus (bool pathStart, OutputIndex outBegin, OutputIndex outEnd, InputIndex& inPos, OutputIndex& outPos, TransSelector ts) const;  // selects a cell in output rows [outBegin,outEnd] at which a local alignment ends (or, if pathStart, starts)
+
+  inline void pathIterate (TransVisitor visit, const EvaluatedTransTable& transTable, StateIndex s, InputToken inTok, OutputToken outTok, InputIndex inPos, OutputIndex outPos) const {
+    iterate (transTable, s, inTok, outTok, inPos, outPos, visit);
   }
 
-  static inline double sum_reduce (double x, double y) { return log_sum_exp(x,y); }
-  static inline double max_reduce (double x, double y) { return max(x,y); }
+  // semiring-generic fill kernels
+  template<class Semiring> void fillIncoming (StateIndex startState, const char* name);  // fill from (0,0,startState), reducing over incoming transitions
+  template<class Semiring> void fillOutgoing (StateIndex endState, const char* name);  // fill from (inLen,outLen,endState), reducing over outgoing transitions
+  template<class Semiring> void fillIncomingCell (InputIndex inPos, OutputIndex outPos, StateIndex startState, double* terms);  // all states at (inPos,outPos); terms is scratch space for machine.incoming.maxStateTrans+1 values
+  template<class Semiring> void fillIncomingCell (InputIndex inPos, OutputIndex outPos, InputToken inTok, OutputToken outTok, StateIndex startState, double* terms);  // tokens given by the caller, e.g. for output not (yet) in the output member
+  template<class Semiring> void fillOutgoingCell (InputIndex inPos, OutputIndex outPos, StateIndex endState, double* terms);
+  template<class CellFiller> void fillWavefront (bool reverse, CellFiller fillCell, size_t nTerms, const char* name);  // tiled, multi-threaded fill
+  template<class Semiring> void fillIncomingPruned (StateIndex startState, double xDrop, const char* name);  // serial anti-diagonal fill with X-drop pruning; sets pruned
   
 public:
   const EvaluatedMachine& machine;
@@ -122,18 +266,20 @@ public:
   const InputIndex inLen;
   const OutputIndex outLen;
   const StateIndex nStates;
+  const DPOptions options;
+  bool pruned;  // true if X-drop pruning removed any cells, in which case the matrix's log-likelihood is a lower bound
 
-  DPMatrix (const EvaluatedMachine&, const SeqPair&);
-  DPMatrix (const EvaluatedMachine&, const SeqPair&, const Envelope&);
+  DPMatrix (const EvaluatedMachine&, const SeqPair&, const DPOptions& = DPOptions());
+  DPMatrix (const EvaluatedMachine&, const SeqPair&, const Envelope&, const DPOptions& = DPOptions());
 
   void writeJson (ostream& out) const;
   
-  inline double& cell (InputIndex inPos, OutputIndex outPos, StateIndex state) {
+  inline Cell& cell (InputIndex inPos, OutputIndex outPos, StateIndex state) {
     return cellStorage[cellIndex(inPos,outPos,state)];
   }
 
   inline const double cell (InputIndex inPos, OutputIndex outPos, StateIndex state) const {
-    return IndexMapper::env.contains(inPos,outPos) ? cellStorage[cellIndex(inPos,outPos,state)] : -numeric_limits<double>::infinity();
+    return IndexMapper::contains(inPos,outPos) ? cellStorage[cellIndex(inPos,outPos,state)] : -numeric_limits<double>::infinity();
   }
 
   double startCell() const { return cell (0, 0, machine.startState()); }
@@ -143,14 +289,41 @@ public:
   static size_t selectMaxTrans (const vguard<double>&);
   static TransSelector randomTransSelector (mt19937&);
   
+  // Tracebacks stop at the start of the path (or at the end, for traceForward); for local alignment, this may be anywhere the path can start (or end).
+  // traceBack(m) and traceForward(m) also select where the path ends (or starts), using the TransSelector.
+  // The TraceTerminator forms return true if the trace reached the start (or end) of the path, and false if stopped by the TraceTerminator.
   MachinePath traceBack (const Machine& m, TransSelector ts = DPMatrix::selectMaxTrans) const;
+  MachinePath traceBack (const Machine& m, InputIndex& inStart, OutputIndex& outStart, TransSelector ts = DPMatrix::selectMaxTrans) const;  // also sets (inStart,outStart) to the cell where the path starts
   MachinePath traceBack (const Machine& m, StateIndex s, TransSelector ts = DPMatrix::selectMaxTrans) const;
   MachinePath traceBack (const Machine& m, InputIndex inPos, OutputIndex outPos, StateIndex s, TransSelector ts = DPMatrix::selectMaxTrans) const;
-  void traceBack (const Machine& m, InputIndex inPos, OutputIndex outPos, StateIndex s, TraceTerminator stopTrace, TransSelector ts = DPMatrix::selectMaxTrans) const;
+  bool traceBack (const Machine& m, InputIndex inPos, OutputIndex outPos, StateIndex s, TraceTerminator stopTrace, TransSelector ts = DPMatrix::selectMaxTrans) const;
 
   MachinePath traceForward (const Machine& m, TransSelector ts = DPMatrix::selectMaxTrans) const;
   MachinePath traceForward (const Machine& m, InputIndex inPos, OutputIndex outPos, StateIndex s, TransSelector ts = DPMatrix::selectMaxTrans) const;
-  void traceForward (const Machine& m, InputIndex inPos, OutputIndex outPos, StateIndex s, TraceTerminator stopTrace, TransSelector ts = DPMatrix::selectMaxTrans) const;
+  bool traceForward (const Machine& m, InputIndex inPos, OutputIndex outPos, StateIndex s, TraceTerminator stopTrace, TransSelector ts = DPMatrix::selectMaxTrans) const;
+};
+
+// DP matrix filled from (0,0,startState) over incoming transitions, keeping O(sqrt(outLen)) rows of memory.
+// The fill keeps only every blockSize'th output row (a checkpoint).
+// Rows between consecutive checkpoints can then be recomputed, one block at a time, by loadBlock().
+// Recomputed cells are identical to those of a full fill, for roughly twice the compute.
+template<class Semiring>
+class CheckpointedDPMatrix : public DPMatrix<BlockOutputIndexMapper> {
+protected:
+  vguard<vguard<double> > checkpoint;  // checkpoint[n] = cells in output row n*blockSize
+  vguard<double> terms;
+  double endLogLike;
+  void fillBlock (OutputIndex blockBegin);  // fills rows (blockBegin,blockBegin+blockSize] from the checkpoint at blockBegin
+  void saveRow (OutputIndex outPos);
+  void loadRow (OutputIndex outPos);
+
+public:
+  CheckpointedDPMatrix (const EvaluatedMachine&, const SeqPair&, const Envelope&, const char* name, const DPOptions& = DPOptions());
+  double logLike() const { return endLogLike; }
+  inline OutputIndex blockBegin (OutputIndex outPos) const {  // first row of the block in which outPos is not the first row (unless outPos is 0)
+    return outPos ? ((outPos - 1) / blockSize) * blockSize : 0;
+  }
+  void loadBlock (OutputIndex outPos);  // makes cells in output row outPos, and the row before it, accessible
 };
 
 #include "dpmatrix.defs.h"
@@ -1,6 +1,6 @@
 #include <gsl/gsl_linalg.h>
 #include "eval.h"
-#include "weight.h"
+#include "weightvm.h"
 #include "util.h"
 #include "logger.h"
 #include "logsumexp.h"
@@ -43,8 +43,20 @@ void EvaluatedMachine::init (const Machine& machine, const Params* params)
 {
   Assert (machine.isAdvancingMachine(), "Machine is not topologically sorted");
 
+  // evaluate all the transition weights in one pass
+  vguard<double> transWeight;
+  if (params) {
+    vguard<WeightExpr> weightExpr;
+    for (const auto& ms: machine.state)
+      for (const auto& trans: ms.trans)
+	weightExpr.push_back (trans.weight);
+    const WeightProgram prog (weightExpr, params->defs);
+    LogThisAt(7,"Compiled " << plural(weightExpr.size(),"transition weight") << " into " << plural(prog.code.size(),"instruction") << " using " << plural(prog.nRegisters(),"register") << endl);
+    transWeight = prog.run();
+  }
+
   ProgressLog(plog,6);
-  plog.initProgress ("Evaluating transition weights");
+  plog.initProgress ("Indexing transitions");
 
   EvaluatedMachineState::TransIndex tiCum = 0;
   for (StateIndex s = 0; s < nStates(); ++s) {
@@ -56,7 +68,7 @@ void EvaluatedMachine::init (const Machine& machine, const Params* params)
       const StateIndex d = trans.dest;
       const InputToken in = inputTokenizer.sym2tok.at (trans.in);
       const OutputToken out = outputTokenizer.sym2tok.at (trans.out);
-      const LogWeight lw = params ? log (WeightAlgebra::eval (trans.weight, params->defs)) : 0.;
+      const LogWeight lw = params ? log (transWeight[tiCum + ti]) : 0.;
       state[s].outgoing[in][out].insert (EvaluatedMachineState::StateTransMap::value_type (d, EvaluatedMachineState::Trans ({ .logWeight = lw, .transIndex = ti })));
       state[d].incoming[in][out].insert (EvaluatedMachineState::StateTransMap::value_type (s, EvaluatedMachineState::Trans ({ .logWeight = lw, .transIndex = ti })));
       state[s].logTransWeight.push_back (lw);
@@ -67,6 +79,65 @@ void EvaluatedMachine::init (const Machine& machine, const Params* params)
     tiCum += ti;
   }
   nTransitions = tiCum;
+
+  const InputToken nInToks = inputTokenizer.tok2sym.size();
+  const OutputToken nOutToks = outputTokenizer.tok2sym.size();
+  incoming.init (state, nInToks, nOutToks, true);
+  outgoing.init (state, nInToks, nOutToks, false);
+}
+
+void EvaluatedTransTable::init (const vguard<EvaluatedMachineState>& ems, InputToken nIn, OutputToken nOut, bool useIncoming) {
+  nInToks = nIn;
+  nOutToks = nOut;
+  const StateIndex nStates = ems.size();
+  offset = vguard<Offset> (nStates * nInToks * nOutToks + 1, 0);
+  state.clear();
+  logWeight.clear();
+  weight.clear();
+  transIndex.clear();
+  for (StateIndex s = 0; s < nStates; ++s) {
+    const EvaluatedMachineState::InOutStateTransMap& inOutStateTransMap = useIncoming ? ems[s].incoming : ems[s].outgoing;
+    for (InputToken inTok = 0; inTok < nInToks; ++inTok)
+      for (OutputToken outTok = 0; outTok < nOutToks; ++outTok) {
+	offset[classIndex(s,inTok,outTok)] = state.size();
+	if (inOutStateTransMap.count (inTok)) {
+	  const EvaluatedMachineState::OutStateTransMap& outStateTransMap = inOutStateTransMap.at (inTok);
+	  if (outStateTransMap.count (outTok))
+	    for (const auto& st: outStateTransMap.at (outTok)) {
+	      state.push_back (st.first);
+	      logWeight.push_back (st.second.logWeight);
+	      weight.push_back (exp (st.second.logWeight));
+	      transIndex.push_back (st.second.transIndex);
+	    }
+	}
+      }
+  }
+  offset.back() = state.size();
+  maxStateTrans = 0;
+  for (StateIndex s = 0; s < nStates; ++s)
+    maxStateTrans = max (maxStateTrans, (size_t) (offset[classIndex(s+1,0,0)] - offset[classIndex(s,0,0)]));
+  activeOffset = vguard<Offset> (nInToks * nOutToks + 1, 0);
+  activeState.clear();
+  for (InputToken inTok = 0; inTok < nInToks; ++inTok)
+    for (OutputToken outTok = 0; outTok < nOutToks; ++outTok) {
+      activeOffset[pairIndex(inTok,outTok)] = activeState.size();
+      for (StateIndex s = 0; s < nStates; ++s)
+	if (!empty(s,inTok,outTok) || !empty(s,inTok,0) || !empty(s,0,outTok) || !empty(s,0,0))
+	  activeState.push_back (s);
+    }
+  activeOffset.back() = activeState.size();
+  size_t nPairs = 0, nTerms = 0;
+  for (InputToken inTok = 1; inTok < nInToks; ++inTok)
+    for (OutputToken outTok = 1; outTok < nOutToks; ++outTok) {
+      for (Offset n = activeBegin (inTok, outTok); n < activeEnd (inTok, outTok); ++n) {
+	const StateIndex s = activeState[n];
+	nTerms += (end(s,inTok,outTok) - begin(s,inTok,outTok)) + (end(s,inTok,0) - begin(s,inTok,0))
+	  + (end(s,0,outTok) - begin(s,0,outTok)) + (end(s,0,0) - begin(s,0,0));
+      }
+      ++nPairs;
+    }
+  termsPerCell = nPairs ? (nTerms / (double) nPairs) : (double) state.size();
+  LogThisAt(7,(useIncoming ? "Incoming" : "Outgoing") << " transition table: " << activeState.size() << " active states for " << (nInToks * nOutToks) << " token pairs (" << (int) (100. * activeState.size() / max ((size_t) 1, (size_t) (nInToks * nOutToks * nStates)) + .5) << "% of " << nStates << " states per pair, on average)" << endl);
 }
 
 StateIndex EvaluatedMachine::nStates() const {
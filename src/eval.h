@@ -75,11 +75,63 @@ struct EvaluatedMachineState {
   InputToken bestOutgoingToken (StateIndex dest, OutputToken out) const;  // for a given destination state & output token, find the best input token
 };
 
+// Compressed-sparse-row (CSR) transition table, used by the inner loops of the DP algorithms.
+// Transitions into (or out of) each state are grouped by (input token, output token) class,
+// in the same order as the corresponding EvaluatedMachineState map, so that DP sums are unchanged.
+// Transitions in class (s,inTok,outTok) occupy the half-open range [begin(s,inTok,outTok),end(s,inTok,outTok))
+// of the parallel arrays state, logWeight, weight and transIndex.
+// For each cell token pair (inTok,outTok), the table also lists the active states: those with a transition in any of the
+// classes (inTok,outTok), (inTok,empty), (empty,outTok) or (empty,empty) that a DP cell with those tokens reduces over.
+// Token zero is the empty token, so this also covers cells at the start (or end) of the input or output.
+// Other states have no terms in such a cell, so the fills can skip them.
+struct EvaluatedTransTable {
+  typedef size_t Offset;
+  typedef EvaluatedMachineState::TransIndex TransIndex;
+
+  InputToken nInToks;
+  OutputToken nOutToks;
+  vguard<Offset> offset;  // offset[classIndex(s,inTok,outTok)] = index of first transition in class
+  vguard<StateIndex> state;  // source state (for incoming transitions) or destination state (for outgoing transitions)
+  vguard<LogWeight> logWeight;
+  vguard<double> weight;  // exp(logWeight), for probability-space DP
+  vguard<TransIndex> transIndex;  // index of transition in source state's TransList
+  size_t maxStateTrans;  // maximum number of transitions into (or out of) any one state, i.e. scratch space needed to gather them
+  vguard<Offset> activeOffset;  // activeOffset[pairIndex(inTok,outTok)] = index in activeState of first active state for that token pair
+  vguard<StateIndex> activeState;  // active states for each token pair, in increasing order
+  double termsPerCell;  // mean number of transitions reduced over per interior (inPos,outPos) cell, summed over active states, averaged over token pairs (inTok>0,outTok>0); used by DPPlanner
+
+  inline Offset classIndex (StateIndex s, InputToken inTok, OutputToken outTok) const {
+    return (s * nInToks + inTok) * nOutToks + outTok;
+  }
+  inline Offset begin (StateIndex s, InputToken inTok, OutputToken outTok) const {
+    return offset[classIndex (s, inTok, outTok)];
+  }
+  inline Offset end (StateIndex s, InputToken inTok, OutputToken outTok) const {
+    return offset[classIndex (s, inTok, outTok) + 1];
+  }
+  inline bool empty (StateIndex s, InputToken inTok, OutputToken outTok) const {
+    return begin (s, inTok, outTok) == end (s, inTok, outTok);
+  }
+
+  inline Offset pairIndex (InputToken inTok, OutputToken outTok) const {
+    return inTok * nOutToks + outTok;
+  }
+  inline Offset activeBegin (InputToken inTok, OutputToken outTok) const {
+    return activeOffset[pairIndex (inTok, outTok)];
+  }
+  inline Offset activeEnd (InputToken inTok, OutputToken outTok) const {
+    return activeOffset[pairIndex (inTok, outTok) + 1];
+  }
+
+  void init (const vguard<EvaluatedMachineState>& state, InputToken nInToks, OutputToken nOutToks, bool useIncoming);
+};
+
 struct EvaluatedMachine {
   InputTokenizer inputTokenizer;
   OutputTokenizer outputTokenizer;
   vguard<EvaluatedMachineState> state;
   EvaluatedMachineState::TransIndex nTransitions;
+  EvaluatedTransTable incoming, outgoing;  // CSR copies of state[].incoming and state[].outgoing
   EvaluatedMachine() { }
   EvaluatedMachine (const Machine&, const Params&);  // use machine.getParamDefs(true) to set missing parameters automatically
   EvaluatedMachine (const Machine&);  // WARNING: if this constructor is used, and no Params are supplied, all logWeight's will be zero
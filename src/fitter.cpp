@@ -1,6 +1,7 @@
 #include "fitter.h"
 #include "eval.h"
 #include "counts.h"
+#include "planner.h"
 #include "logger.h"
 
 #define MaxEMIterations 1000
@@ -27,7 +28,9 @@ Params MachineFitter::fit (const SeqPairList& trainingSet, const list<Envelope>&
   for (size_t iter = 0; true; ++iter) {
     const Params allParams = machine.funcs.combine(constants).combine(params);
     const EvaluatedMachine eval (machine, allParams);
-    const MachineCounts counts (eval, trainingSet, envelopes);
+    if (iter == 0)  // the plan depends only on the machine's structure, so it is the same for every iteration
+      (void) DPPlanner (eval, options).planBatch (DPTask::ForwardBackward, vguard<SeqPair> (trainingSet.seqPairs.begin(), trainingSet.seqPairs.end()), vguard<Envelope> (envelopes.begin(), envelopes.end()));
+    const MachineCounts counts (eval, trainingSet, envelopes, options);
     LogThisAt(2,"Baum-Welch iteration #" << (iter+1) << ": log-likelihood " << counts.loglike << endl);
     LogThisAt(4,"Parameters:" << endl << JsonWriter<Params>::toJsonString(params) << endl);
     if (iter > 0) {
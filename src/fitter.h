@@ -5,6 +5,7 @@
 #include "params.h"
 #include "constraints.h"
 #include "seqpair.h"
+#include "dpmatrix.h"
 
 namespace MachineBoss {
 
@@ -12,6 +13,7 @@ struct MachineFitter {
   Machine machine;
   Constraints constraints;
   Params seed, constants;
+  DPOptions options;
 
   Constraints allConstraints() const;  // combines machine.cons and constraints
   Params fit (const SeqPairList&) const;
@@ -2,22 +2,47 @@
 
 using namespace MachineBoss;
 
-ForwardMatrix::ForwardMatrix (const EvaluatedMachine& m, const SeqPair& s)
-  : MappedForwardMatrix (m, s)
-{ }
-
-ForwardMatrix::ForwardMatrix (const EvaluatedMachine& m, const SeqPair& s, const Envelope& e)
-  : MappedForwardMatrix (m, s, e)
-{ }
+IncrementalForwardMatrix::IncrementalForwardMatrix (const EvaluatedMachine& machine, const vguard<InputSymbol>& inputSeq, const DPOptions& options) :
+  IncrementalForwardInput (inputSeq),
+  DPMatrix<StreamingOutputIndexMapper> (machine, inputOnly, Envelope::fullEnvelope (inputOnly), options),
+  nAppended (0),
+  prefixLL (0),
+  terms (machine.incoming.maxStateTrans + 1)
+{
+  Assert (!options.local.enabled(), "Incremental Forward does not support local alignment");
+  fillRow (OutputTokenizer::emptyToken());
+}
 
-ForwardMatrix::ForwardMatrix (const EvaluatedMachine& m, const SeqPair& s, const Envelope& e, StateIndex startState)
-  : MappedForwardMatrix (m, s, e, startState)
-{ }
+void IncrementalForwardMatrix::appendOutput (const vguard<OutputToken>& outToks) {
+  for (auto outTok: outToks) {
+    ++nAppended;
+    fillRow (outTok);
+  }
+}
 
-MachinePath ForwardMatrix::samplePath (const Machine& m, mt19937& rng) const {
-  return traceBack (m, randomTransSelector (rng));
+void IncrementalForwardMatrix::appendOutput (const vguard<OutputSymbol>& outSyms) {
+  appendOutput (machine.outputTokenizer.tokenize (outSyms));
 }
 
-MachinePath ForwardMatrix::samplePath (const Machine& m, StateIndex s, mt19937& rng) const {
-  return traceBack (m, s, randomTransSelector (rng));
+void IncrementalForwardMatrix::fillRow (OutputToken outTok) {
+  for (InputIndex inPos = 0; inPos <= inLen; ++inPos)
+    fillIncomingCell<LogSumSemiring> (inPos, nAppended, inPos ? input[inPos-1] : InputTokenizer::emptyToken(), outTok, machine.startState(), terms.data());
+  if (!nAppended)
+    return;
+  // sum over the transitions that emit the latest output token, from the previous row (which is still in the other half of the storage)
+  double rowEmitLL = -numeric_limits<double>::infinity();
+  const EvaluatedTransTable& incoming = machine.incoming;
+  for (InputIndex inPos = 0; inPos <= inLen; ++inPos) {
+    const InputToken inTok = inPos ? input[inPos-1] : InputTokenizer::emptyToken();
+    const EvaluatedTransTable::Offset end = incoming.activeEnd (inTok, outTok);
+    for (EvaluatedTransTable::Offset n = incoming.activeBegin (inTok, outTok); n < end; ++n) {
+      double* term = terms.data();
+      if (inPos)
+	gather (term, incoming, incoming.activeState[n], inTok, outTok, inPos - 1, nAppended - 1);
+      gather (term, incoming, incoming.activeState[n], InputTokenizer::emptyToken(), outTok, inPos, nAppended - 1);
+      if (term > terms.data())
+	rowEmitLL = log_sum_exp (rowEmitLL, log_sum_exp_array (terms.data(), term - terms.data()));
+    }
+  }
+  prefixLL = rowEmitLL;
 }
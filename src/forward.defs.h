@@ -1,55 +1,154 @@
-template<class IndexMapper>
-MappedForwardMatrix<IndexMapper>::MappedForwardMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair) :
-  DPMatrix<IndexMapper> (machine, seqPair)
+template<class IndexMapper,class Cell>
+MappedForwardMatrix<IndexMapper,Cell>::MappedForwardMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const DPOptions& options) :
+  DPMatrix<IndexMapper,Cell> (machine, seqPair, options)
 {
   fill (machine.startState());
 }
 
-template<class IndexMapper>
-MappedForwardMatrix<IndexMapper>::MappedForwardMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const Envelope& env) :
-  DPMatrix<IndexMapper> (machine, seqPair, env)
+template<class IndexMapper,class Cell>
+MappedForwardMatrix<IndexMapper,Cell>::MappedForwardMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const Envelope& env, const DPOptions& options) :
+  DPMatrix<IndexMapper,Cell> (machine, seqPair, env, options)
 {
   fill (machine.startState());
 }
 
-template<class IndexMapper>
-MappedForwardMatrix<IndexMapper>::MappedForwardMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const Envelope& env, StateIndex startState) :
-  DPMatrix<IndexMapper> (machine, seqPair, env)
+template<class IndexMapper,class Cell>
+MappedForwardMatrix<IndexMapper,Cell>::MappedForwardMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const Envelope& env, StateIndex startState, const DPOptions& options) :
+  DPMatrix<IndexMapper,Cell> (machine, seqPair, env, options)
 {
   fill (startState);
 }
 
-template<class IndexMapper>
-void MappedForwardMatrix<IndexMapper>::fill (StateIndex startState) {
-  typedef DPMatrix<IndexMapper> DPM;
-  ProgressLog(plogDP,6);
-  plogDP.initProgress ("Filling Forward matrix (%lu cells)", DPM::nCellsComputed());
-  typename DPM::CellIndex nCellsDone = 0;
-  for (typename DPM::OutputIndex outPos = 0; outPos <= DPM::outLen; ++outPos) {
+template<class IndexMapper,class Cell>
+MappedForwardMatrix<IndexMapper,Cell>::MappedForwardMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const Envelope& env, const PruningSettings& pruning, const DPOptions& options) :
+  DPMatrix<IndexMapper,Cell> (machine, seqPair, env, options)
+{
+  fill (machine.startState(), pruning);
+}
+
+template<class IndexMapper,class Cell>
+void MappedForwardMatrix<IndexMapper,Cell>::fill (StateIndex startState, const PruningSettings& pruning) {
+  if (pruning.enabled() || IndexMapper::diagonalOrder)
+    DPMatrix<IndexMapper,Cell>::template fillIncomingPruned<LogSumSemiring> (startState, pruning.xDrop, "Forward");
+  else
+    DPMatrix<IndexMapper,Cell>::template fillIncoming<LogSumSemiring> (startState, "Forward");
+}
+
+template<class IndexMapper,class Cell>
+double MappedForwardMatrix<IndexMapper,Cell>::logLike() const {
+  typedef DPMatrix<IndexMapper,Cell> DPM;
+  if (DPM::options.local.enabled())
+    return DPM::template terminusLogLike<LogSumSemiring>();
+  return DPM::cell (DPM::inLen, DPM::outLen, DPM::machine.endState());
+}
+
+template<class IndexMapper,class Cell>
+MachinePath MappedForwardMatrix<IndexMapper,Cell>::samplePath (const Machine& m, mt19937& rng) const {
+  typedef DPMatrix<IndexMapper,Cell> DPM;
+  return DPM::traceBack (m, DPM::randomTransSelector (rng));
+}
+
+template<class IndexMapper,class Cell>
+MachinePath MappedForwardMatrix<IndexMapper,Cell>::samplePath (const Machine& m, StateIndex s, mt19937& rng) const {
+  typedef DPMatrix<IndexMapper,Cell> DPM;
+  return DPM::traceBack (m, s, DPM::randomTransSelector (rng));
+}
+
+// Stochastic traceback with one random number per step, and no per-step allocation.
+// The incoming terms of a cell sum to its Forward value, so a transition can be selected in one pass over them,
+// stopping as soon as the cumulative probability exceeds the random number.
+template<class IndexMapper,class Cell>
+void MappedForwardMatrix<IndexMapper,Cell>::sampleTrace (Trace& trace, InputIndex& inPos, OutputIndex& outPos, mt19937& rng) const {
+  typedef DPMatrix<IndexMapper,Cell> DPM;
+  trace.clear();
+  inPos = DPM::inLen;
+  outPos = DPM::outLen;
+  StateIndex s = DPM::machine.endState();
+  if (DPM::options.local.enabled())
+    DPM::selectTerminus (false, 0, DPM::outLen, inPos, outPos, DPM::randomTransSelector (rng));
+  Assert (DPM::cell(inPos,outPos,s) > -numeric_limits<double>::infinity(), "Can't sample path: no finite-weight paths");
+  uniform_real_distribution<double> dist (0, 1);
+  while (inPos > 0 || outPos > 0 || s != DPM::machine.startState()) {
+    const double cellLogLike = DPM::cell (inPos, outPos, s);
+    double variate = dist (rng);
+    if (s == DPM::machine.startState() && DPM::canStart (inPos, outPos)) {  // the option of starting a local alignment here
+      variate -= exp (-cellLogLike);
+      if (variate <= 0)
+	break;
+    }
+    bool found = false, consumesInput = false, consumesOutput = false, inClass, outClass;
+    StateIndex src = 0;
+    EvaluatedMachineState::TransIndex transIndex = 0;
+    auto visit = [&] (StateIndex srcState, EvaluatedMachineState::TransIndex ti, double logLike) {
+      if (found || logLike == -numeric_limits<double>::infinity())
+	return;
+      src = srcState;  // the last finite-weight transition is the fallback, in case of rounding error
+      transIndex = ti;
+      consumesInput = inClass;
+      consumesOutput = outClass;
+      variate -= exp (logLike - cellLogLike);
+      found = variate <= 0;
+    };
+    const InputToken inTok = inPos ? DPM::input[inPos-1] : InputTokenizer::emptyToken();
     const OutputToken outTok = outPos ? DPM::output[outPos-1] : OutputTokenizer::emptyToken();
-    for (typename DPM::InputIndex inPos = DPM::env.inStart[outPos]; inPos < DPM::env.inEnd[outPos]; ++inPos) {
-      const InputToken inTok = inPos ? DPM::input[inPos-1] : InputTokenizer::emptyToken();
-      for (StateIndex d = 0; d < DPM::nStates; ++d) {
-	plogDP.logProgress (nCellsDone / (double) DPM::nCellsComputed(), "filled %lu cells", nCellsDone);
-	++nCellsDone;
-	const EvaluatedMachineState& state = DPM::machine.state[d];
-	double ll = (inPos || outPos || d != startState) ? -numeric_limits<double>::infinity() : 0;
-	if (inPos && outPos)
-	  DPM::accumulate (ll, state.incoming, inTok, outTok, inPos - 1, outPos - 1, DPM::sum_reduce);
-	if (inPos)
-	  DPM::accumulate (ll, state.incoming, inTok, OutputTokenizer::emptyToken(), inPos - 1, outPos, DPM::sum_reduce);
-	if (outPos)
-	  DPM::accumulate (ll, state.incoming, InputTokenizer::emptyToken(), outTok, inPos, outPos - 1, DPM::sum_reduce);
-	DPM::accumulate (ll, state.incoming, InputTokenizer::emptyToken(), OutputTokenizer::emptyToken(), inPos, outPos, DPM::sum_reduce);
-	DPM::cell(inPos,outPos,d) = ll;
-      }
+    if (inPos && outPos) {
+      inClass = outClass = true;
+      DPM::iterate (DPM::machine.incoming, s, inTok, outTok, inPos - 1, outPos - 1, visit);
+    }
+    if (inPos) {
+      inClass = true;
+      outClass = false;
+      DPM::iterate (DPM::machine.incoming, s, inTok, OutputTokenizer::emptyToken(), inPos - 1, outPos, visit);
     }
+    if (outPos) {
+      inClass = false;
+      outClass = true;
+      DPM::iterate (DPM::machine.incoming, s, InputTokenizer::emptyToken(), outTok, inPos, outPos - 1, visit);
+    }
+    inClass = outClass = false;
+    DPM::iterate (DPM::machine.incoming, s, InputTokenizer::emptyToken(), OutputTokenizer::emptyToken(), inPos, outPos, visit);
+    trace.push_back (typename Trace::value_type (src, transIndex));
+    if (consumesInput) --inPos;
+    if (consumesOutput) --outPos;
+    s = src;
   }
-  LogThisAt(8,"Forward matrix:" << endl << *this);
 }
 
-template<class IndexMapper>
-double MappedForwardMatrix<IndexMapper>::logLike() const {
-  typedef DPMatrix<IndexMapper> DPM;
-  return DPM::cell (DPM::inLen, DPM::outLen, DPM::machine.endState());
+// Paths are sampled in chunks of SamplePathsChunkSize, concurrently.
+// Each chunk has its own random number stream, seeded by the seed words followed by the chunk index,
+// so the result depends only on the seed, and not on the number of threads.
+template<class IndexMapper,class Cell>
+vguard<typename MappedForwardMatrix<IndexMapper,Cell>::SampledPath> MappedForwardMatrix<IndexMapper,Cell>::samplePaths (const Machine& m, size_t nPaths, const vguard<unsigned int>& seed, WorkStealingPool& pool) const {
+  typedef pair<pair<InputIndex,OutputIndex>,Trace> StartTrace;  // local alignments with the same transitions, but different start cells, are different paths
+  const size_t nChunks = (nPaths + SamplePathsChunkSize - 1) / SamplePathsChunkSize;
+  vguard<map<StartTrace,size_t> > chunkTraceCount (nChunks);
+  pool.run (nChunks, [&] (size_t chunk) {
+      vguard<unsigned int> chunkSeed (seed);
+      chunkSeed.push_back (chunk);
+      seed_seq seq (chunkSeed.begin(), chunkSeed.end());
+      mt19937 rng (seq);
+      StartTrace startTrace;
+      const size_t chunkPaths = min ((size_t) SamplePathsChunkSize, nPaths - chunk * SamplePathsChunkSize);
+      for (size_t n = 0; n < chunkPaths; ++n) {
+	sampleTrace (startTrace.second, startTrace.first.first, startTrace.first.second, rng);
+	++chunkTraceCount[chunk][startTrace];
+      }
+    });
+  map<StartTrace,size_t> traceCount;
+  for (const auto& tc: chunkTraceCount)
+    for (const auto& trace_count: tc)
+      traceCount[trace_count.first] += trace_count.second;
+  vguard<SampledPath> result;
+  result.reserve (traceCount.size());
+  for (const auto& trace_count: traceCount) {
+    SampledPath sampled;
+    for (const auto& s_t: trace_count.first.second)
+      sampled.path.trans.push_front (m.state[s_t.first].getTransition (s_t.second));
+    sampled.count = trace_count.second;
+    sampled.inStart = trace_count.first.first.first;
+    sampled.outStart = trace_count.first.first.second;
+    result.push_back (sampled);
+  }
+  stable_sort (result.begin(), result.end(), [] (const SampledPath& a, const SampledPath& b) { return a.count > b.count; });
+  return result;
 }
@@ -5,27 +5,69 @@
 
 namespace MachineBoss {
 
-template<class IndexMapper>
-class MappedForwardMatrix : public DPMatrix<IndexMapper> {
+// Number of paths sampled with each random number stream by MappedForwardMatrix::samplePaths
+#define SamplePathsChunkSize 1024
+
+template<class IndexMapper, class Cell = double>
+class MappedForwardMatrix : public DPMatrix<IndexMapper,Cell> {
 private:
-  void fill (StateIndex startState);
+  void fill (StateIndex startState, const PruningSettings& = PruningSettings());
 public:
-  MappedForwardMatrix (const EvaluatedMachine&, const SeqPair&);
-  MappedForwardMatrix (const EvaluatedMachine&, const SeqPair&, const Envelope&);
-  MappedForwardMatrix (const EvaluatedMachine&, const SeqPair&, const Envelope&, StateIndex startState);
-  double logLike() const;
-};
+  typedef typename DPMatrix<IndexMapper,Cell>::InputIndex InputIndex;
+  typedef typename DPMatrix<IndexMapper,Cell>::OutputIndex OutputIndex;
+  typedef vguard<pair<StateIndex,EvaluatedMachineState::TransIndex> > Trace;  // (source state, transition index) for each transition, from the end of the path back to the start
 
-class ForwardMatrix : public MappedForwardMatrix<IdentityIndexMapper> {
-public:
-  ForwardMatrix (const EvaluatedMachine&, const SeqPair&);
-  ForwardMatrix (const EvaluatedMachine&, const SeqPair&, const Envelope&);
-  ForwardMatrix (const EvaluatedMachine&, const SeqPair&, const Envelope&, StateIndex startState);
-  MachinePath samplePath (const Machine&, mt19937&) const;
+  // a distinct sampled path, with its multiplicity and the cell where it starts, which is (0,0) unless local alignment is enabled
+  struct SampledPath {
+    MachinePath path;
+    size_t count;
+    InputIndex inStart;
+    OutputIndex outStart;
+  };
+
+  MappedForwardMatrix (const EvaluatedMachine&, const SeqPair&, const DPOptions& = DPOptions());
+  MappedForwardMatrix (const EvaluatedMachine&, const SeqPair&, const Envelope&, const DPOptions& = DPOptions());
+  MappedForwardMatrix (const EvaluatedMachine&, const SeqPair&, const Envelope&, StateIndex startState, const DPOptions& = DPOptions());
+  MappedForwardMatrix (const EvaluatedMachine&, const SeqPair&, const Envelope&, const PruningSettings&, const DPOptions& = DPOptions());  // if pruned is set, logLike() is a lower bound
+  double logLike() const;
+  MachinePath samplePath (const Machine&, mt19937&) const;  // requires an IndexMapper that stores all cells
   MachinePath samplePath (const Machine&, StateIndex, mt19937&) const;
+  void sampleTrace (Trace&, InputIndex& inStart, OutputIndex& outStart, mt19937&) const;  // requires an IndexMapper that stores all cells
+  vguard<SampledPath> samplePaths (const Machine&, size_t nPaths, const vguard<unsigned int>& seed, WorkStealingPool&) const;  // most frequent first
 };
 
+typedef MappedForwardMatrix<IdentityIndexMapper> ForwardMatrix;
+typedef MappedForwardMatrix<IdentityIndexMapper,float> FloatForwardMatrix;
 typedef MappedForwardMatrix<RollingOutputIndexMapper> RollingOutputForwardMatrix;
+typedef MappedForwardMatrix<RollingDiagonalIndexMapper> RollingDiagonalForwardMatrix;  // score only, filled by anti-diagonals (e.g. for X-drop pruning)
+typedef CheckpointedDPMatrix<LogSumSemiring> CheckpointedForwardMatrix;
+
+// Forward algorithm for an output sequence that arrives incrementally (e.g. streamed from a sequencer), given the whole input sequence.
+// Keeps only the two-row frontier of StreamingOutputIndexMapper; each appended output token fills one more row, using the same cell fill as ForwardMatrix.
+// At any point, endLogLike() is the log-likelihood of the output so far being the complete output,
+// and prefixLogLike() is the log-likelihood of the output so far being a prefix of the output
+// (i.e. summed over paths up to the transition that emits the last output token, consuming any prefix of the input).
+struct IncrementalForwardInput {
+  SeqPair inputOnly;  // the input, with no output; outlives the DPMatrix that refers to it
+  IncrementalForwardInput (const vguard<InputSymbol>& inputSeq) { inputOnly.input.seq = inputSeq; }
+};
+
+class IncrementalForwardMatrix : private IncrementalForwardInput, public DPMatrix<StreamingOutputIndexMapper> {
+private:
+  OutputIndex nAppended;  // number of output tokens appended so far (the outLen member is always zero)
+  double prefixLL;
+  vguard<double> terms;
+
+  void fillRow (OutputToken outTok);  // fills row nAppended
+
+public:
+  IncrementalForwardMatrix (const EvaluatedMachine&, const vguard<InputSymbol>& input, const DPOptions& = DPOptions());
+  void appendOutput (const vguard<OutputToken>&);
+  void appendOutput (const vguard<OutputSymbol>&);
+  OutputIndex outputLength() const { return nAppended; }
+  double prefixLogLike() const { return prefixLL; }  // zero if no output has been appended
+  double endLogLike() const { return cell (inLen, nAppended, machine.endState()); }
+};
 
 #include "forward.defs.h"
 
@@ -111,10 +111,11 @@ void ProgressLogger::initProgress (const char* desc, ...) {
   reportInterval = 2;
 
   time_t rawtime;
-  struct tm * timeinfo;
+  struct tm timeinfo;
+  char timebuf[26];
 
   time (&rawtime);
-  timeinfo = localtime (&rawtime);
+  localtime_r (&rawtime, &timeinfo);  // reentrant, since DP fills may be running in several threads
   
   va_list argptr;
   va_start (argptr, desc);
@@ -123,7 +124,7 @@ void ProgressLogger::initProgress (const char* desc, ...) {
 
   if (logger.testVerbosityOrLogTags (verbosity, function, file)) {
     ostringstream l;
-    l << msg << ": started at " << asctime(timeinfo);
+    l << msg << ": started at " << asctime_r (&timeinfo, timebuf);
     logger.print (l.str(), file, line, verbosity);
   }
 }
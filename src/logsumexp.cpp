@@ -3,9 +3,14 @@
 #include "logsumexp.h"
 #include "util.h"
 
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__)) && !defined(__EMSCRIPTEN__)
+#define LOG_SUM_EXP_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
 using namespace MachineBoss;
 
-LogSumExpLookupTable MachineBoss::logSumExpLookupTable = LogSumExpLookupTable();
+const LogSumExpLookupTable MachineBoss::logSumExpLookupTable = LogSumExpLookupTable();
 
 LogSumExpLookupTable::LogSumExpLookupTable() {
   lookup = new double [LOG_SUM_EXP_LOOKUP_ENTRIES];
@@ -55,6 +60,203 @@ double MachineBoss::log_accum_exp_slow (double& a, double b) {
   return a;
 }
 
+// SIMD batch kernels.
+// exp is computed as 2^k * exp(r), where k = round(x/log(2)) and |r| <= log(2)/2, using a degree-13 Taylor polynomial for exp(r).
+// Arguments below ExpArrayMin underflow to zero; arguments above ExpArrayMax overflow to infinity.
+#define ExpArrayMin -708.
+#define ExpArrayMax 709.
+#define ExpLog2e 1.44269504088896338700e+00
+#define ExpLn2Hi 6.93147180369123816490e-01
+#define ExpLn2Lo 1.90821492927058770002e-10
+
+namespace {
+
+  void exp_array_scalar (const double* x, double* y, size_t n) {
+    for (size_t i = 0; i < n; ++i)
+      y[i] = x[i] < ExpArrayMin ? 0 : exp(x[i]);
+  }
+
+  double log_sum_exp_array_scalar (const double* x, size_t n) {
+    double m = -numeric_limits<double>::infinity();
+    for (size_t i = 0; i < n; ++i)
+      m = max (m, x[i]);
+    if (std::isinf(m))
+      return m;
+    double sum = 0;
+    for (size_t i = 0; i < n; ++i)
+      if (x[i] - m >= ExpArrayMin)
+	sum += exp (x[i] - m);
+    return m + log (sum);
+  }
+
+#ifdef LOG_SUM_EXP_X86_DISPATCH
+
+  __attribute__((target("avx2,fma")))
+  inline __m256d exp_avx2 (__m256d x) {
+    const __m256d xc = _mm256_max_pd (_mm256_min_pd (x, _mm256_set1_pd (ExpArrayMax)), _mm256_set1_pd (ExpArrayMin));
+    const __m256d k = _mm256_round_pd (_mm256_mul_pd (xc, _mm256_set1_pd (ExpLog2e)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256d r = _mm256_fnmadd_pd (k, _mm256_set1_pd (ExpLn2Hi), xc);
+    r = _mm256_fnmadd_pd (k, _mm256_set1_pd (ExpLn2Lo), r);
+    __m256d p = _mm256_set1_pd (1./6227020800.);
+    p = _mm256_fmadd_pd (p, r, _mm256_set1_pd (1./479001600.));
+    p = _mm256_fmadd_pd (p, r, _mm256_set1_pd (1./39916800.));
+    p = _mm256_fmadd_pd (p, r, _mm256_set1_pd (1./3628800.));
+    p = _mm256_fmadd_pd (p, r, _mm256_set1_pd (1./362880.));
+    p = _mm256_fmadd_pd (p, r, _mm256_set1_pd (1./40320.));
+    p = _mm256_fmadd_pd (p, r, _mm256_set1_pd (1./5040.));
+    p = _mm256_fmadd_pd (p, r, _mm256_set1_pd (1./720.));
+    p = _mm256_fmadd_pd (p, r, _mm256_set1_pd (1./120.));
+    p = _mm256_fmadd_pd (p, r, _mm256_set1_pd (1./24.));
+    p = _mm256_fmadd_pd (p, r, _mm256_set1_pd (1./6.));
+    p = _mm256_fmadd_pd (p, r, _mm256_set1_pd (1./2.));
+    p = _mm256_fmadd_pd (p, r, _mm256_set1_pd (1.));
+    p = _mm256_fmadd_pd (p, r, _mm256_set1_pd (1.));
+    // 2^k: adding 1.5*2^52 leaves the integer k+1023 in the low mantissa bits, which we shift into the exponent field
+    const __m256d kBiased = _mm256_add_pd (k, _mm256_set1_pd (6755399441055744. + 1023.));
+    const __m256d scale = _mm256_castsi256_pd (_mm256_slli_epi64 (_mm256_castpd_si256 (kBiased), 52));
+    __m256d y = _mm256_mul_pd (p, scale);
+    y = _mm256_blendv_pd (y, _mm256_setzero_pd(), _mm256_cmp_pd (x, _mm256_set1_pd (ExpArrayMin), _CMP_LT_OQ));
+    y = _mm256_blendv_pd (y, _mm256_set1_pd (numeric_limits<double>::infinity()), _mm256_cmp_pd (x, _mm256_set1_pd (ExpArrayMax), _CMP_GT_OQ));
+    return y;
+  }
+
+  __attribute__((target("avx2,fma")))
+  void exp_array_avx2 (const double* x, double* y, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+      _mm256_storeu_pd (y + i, exp_avx2 (_mm256_loadu_pd (x + i)));
+    if (i < n) {
+      double buf[4] = { 0, 0, 0, 0 };
+      for (size_t j = i; j < n; ++j)
+	buf[j-i] = x[j];
+      _mm256_storeu_pd (buf, exp_avx2 (_mm256_loadu_pd (buf)));
+      for (size_t j = i; j < n; ++j)
+	y[j] = buf[j-i];
+    }
+  }
+
+  __attribute__((target("avx2,fma")))
+  double log_sum_exp_array_avx2 (const double* x, size_t n) {
+    // pad the tail with -infinity
+    double tail[4];
+    const size_t nVec = n / 4, nTail = n % 4;
+    for (size_t j = 0; j < 4; ++j)
+      tail[j] = j < nTail ? x[4*nVec+j] : -numeric_limits<double>::infinity();
+    __m256d vmax = _mm256_loadu_pd (tail);
+    for (size_t i = 0; i < nVec; ++i)
+      vmax = _mm256_max_pd (vmax, _mm256_loadu_pd (x + 4*i));
+    double lanes[4];
+    _mm256_storeu_pd (lanes, vmax);
+    const double m = max (max (lanes[0], lanes[1]), max (lanes[2], lanes[3]));
+    if (std::isinf(m))
+      return m;
+    const __m256d vm = _mm256_set1_pd (m);
+    __m256d vsum = exp_avx2 (_mm256_sub_pd (_mm256_loadu_pd (tail), vm));
+    for (size_t i = 0; i < nVec; ++i)
+      vsum = _mm256_add_pd (vsum, exp_avx2 (_mm256_sub_pd (_mm256_loadu_pd (x + 4*i), vm)));
+    _mm256_storeu_pd (lanes, vsum);
+    return m + log ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3]));
+  }
+
+  __attribute__((target("avx512f")))
+  inline __m512d exp_avx512 (__m512d x) {
+    const __m512d xc = _mm512_max_pd (_mm512_min_pd (x, _mm512_set1_pd (ExpArrayMax)), _mm512_set1_pd (ExpArrayMin));
+    const __m512d k = _mm512_roundscale_pd (_mm512_mul_pd (xc, _mm512_set1_pd (ExpLog2e)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m512d r = _mm512_fnmadd_pd (k, _mm512_set1_pd (ExpLn2Hi), xc);
+    r = _mm512_fnmadd_pd (k, _mm512_set1_pd (ExpLn2Lo), r);
+    __m512d p = _mm512_set1_pd (1./6227020800.);
+    p = _mm512_fmadd_pd (p, r, _mm512_set1_pd (1./479001600.));
+    p = _mm512_fmadd_pd (p, r, _mm512_set1_pd (1./39916800.));
+    p = _mm512_fmadd_pd (p, r, _mm512_set1_pd (1./3628800.));
+    p = _mm512_fmadd_pd (p, r, _mm512_set1_pd (1./362880.));
+    p = _mm512_fmadd_pd (p, r, _mm512_set1_pd (1./40320.));
+    p = _mm512_fmadd_pd (p, r, _mm512_set1_pd (1./5040.));
+    p = _mm512_fmadd_pd (p, r, _mm512_set1_pd (1./720.));
+    p = _mm512_fmadd_pd (p, r, _mm512_set1_pd (1./120.));
+    p = _mm512_fmadd_pd (p, r, _mm512_set1_pd (1./24.));
+    p = _mm512_fmadd_pd (p, r, _mm512_set1_pd (1./6.));
+    p = _mm512_fmadd_pd (p, r, _mm512_set1_pd (1./2.));
+    p = _mm512_fmadd_pd (p, r, _mm512_set1_pd (1.));
+    p = _mm512_fmadd_pd (p, r, _mm512_set1_pd (1.));
+    __m512d y = _mm512_scalef_pd (p, k);
+    y = _mm512_mask_blend_pd (_mm512_cmp_pd_mask (x, _mm512_set1_pd (ExpArrayMin), _CMP_LT_OQ), y, _mm512_setzero_pd());
+    y = _mm512_mask_blend_pd (_mm512_cmp_pd_mask (x, _mm512_set1_pd (ExpArrayMax), _CMP_GT_OQ), y, _mm512_set1_pd (numeric_limits<double>::infinity()));
+    return y;
+  }
+
+  __attribute__((target("avx512f")))
+  void exp_array_avx512 (const double* x, double* y, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+      _mm512_storeu_pd (y + i, exp_avx512 (_mm512_loadu_pd (x + i)));
+    if (i < n) {
+      const __mmask8 mask = (__mmask8) ((1u << (n - i)) - 1);
+      _mm512_mask_storeu_pd (y + i, mask, exp_avx512 (_mm512_maskz_loadu_pd (mask, x + i)));
+    }
+  }
+
+  __attribute__((target("avx512f")))
+  double log_sum_exp_array_avx512 (const double* x, size_t n) {
+    const __m512d negInf = _mm512_set1_pd (-numeric_limits<double>::infinity());
+    const size_t nVec = n / 8, nTail = n % 8;
+    const __mmask8 tailMask = (__mmask8) ((1u << nTail) - 1);
+    const __m512d tail = _mm512_mask_loadu_pd (negInf, tailMask, x + 8*nVec);
+    __m512d vmax = tail;
+    for (size_t i = 0; i < nVec; ++i)
+      vmax = _mm512_max_pd (vmax, _mm512_loadu_pd (x + 8*i));
+    const double m = _mm512_reduce_max_pd (vmax);
+    if (std::isinf(m))
+      return m;
+    const __m512d vm = _mm512_set1_pd (m);
+    __m512d vsum = exp_avx512 (_mm512_sub_pd (tail, vm));
+    for (size_t i = 0; i < nVec; ++i)
+      vsum = _mm512_add_pd (vsum, exp_avx512 (_mm512_sub_pd (_mm512_loadu_pd (x + 8*i), vm)));
+    return m + log (_mm512_reduce_add_pd (vsum));
+  }
+
+#endif /* LOG_SUM_EXP_X86_DISPATCH */
+
+  struct SimdKernels {
+    void (*exp_array) (const double*, double*, size_t);
+    double (*log_sum_exp_array) (const double*, size_t);
+    const char* name;
+    SimdKernels() :
+      exp_array (exp_array_scalar),
+      log_sum_exp_array (log_sum_exp_array_scalar),
+      name ("scalar")
+    {
+#ifdef LOG_SUM_EXP_X86_DISPATCH
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports ("avx512f")) {
+	exp_array = exp_array_avx512;
+	log_sum_exp_array = log_sum_exp_array_avx512;
+	name = "avx512";
+      } else if (__builtin_cpu_supports ("avx2") && __builtin_cpu_supports ("fma")) {
+	exp_array = exp_array_avx2;
+	log_sum_exp_array = log_sum_exp_array_avx2;
+	name = "avx2";
+      }
+#endif /* LOG_SUM_EXP_X86_DISPATCH */
+    }
+  };
+
+  const SimdKernels simdKernels;
+}
+
+void MachineBoss::exp_array (const double* x, double* y, size_t n) {
+  simdKernels.exp_array (x, y, n);
+}
+
+double MachineBoss::log_sum_exp_array (const double* x, size_t n) {
+  if (n == 1)
+    return x[0];
+  return simdKernels.log_sum_exp_array (x, n);
+}
+
+const char* MachineBoss::simd_kernel_name() {
+  return simdKernels.name;
+}
+
 vguard<LogProb> MachineBoss::log_vector (const vguard<double>& v) {
   return transform_container<double,vguard<double> > (v, log);
 }
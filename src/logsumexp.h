@@ -39,7 +39,7 @@ struct LogSumExpLookupTable {
   ~LogSumExpLookupTable();
 };
 
-extern LogSumExpLookupTable logSumExpLookupTable;
+extern const LogSumExpLookupTable logSumExpLookupTable;  // filled during static initialization, read-only thereafter (so safe to share between threads)
 
 inline double log_sum_exp_unary (double x) {
   /* returns log(1 + exp(-x)) for nonnegative x */
@@ -116,6 +116,11 @@ inline double log_sum_exp (const vguard<vguard<double> >& v) {
   return lpTot;
 }
 
+/* batch kernels, vectorized with the widest SIMD instruction set that the CPU supports (AVX-512, AVX2, or none; chosen at runtime) */
+void exp_array (const double* x, double* y, size_t n);  /* y[i] = exp(x[i]) */
+double log_sum_exp_array (const double* x, size_t n);  /* returns log(sum_i exp(x[i])), or -infinity if n == 0 */
+const char* simd_kernel_name();  /* "avx512", "avx2" or "scalar" */
+
 double log_sum_exp_slow (double a, double b);  /* does not use lookup table */
 double log_sum_exp_slow (double a, double b, double c);
 double log_sum_exp_slow (double a, double b, double c, double d);
@@ -200,6 +200,29 @@ set<string> Machine::params() const {
   return p;
 }
 
+// collects subexpressions that are referenced more than once, in post-order, so that subexpressions precede the expressions that use them
+static void collectCommonExprs (const WeightExpr expr, const ExprRefCounts& counts, set<WeightExpr>& visited, vguard<WeightExpr>& common) {
+  if (visited.insert(expr).second) {
+    switch (expr->type) {
+    case Null:
+    case Int:
+    case Dbl:
+    case Param:
+      return;
+    case Log:
+    case Exp:
+      collectCommonExprs (expr->args.arg, counts, visited, common);
+      break;
+    default:
+      collectCommonExprs (expr->args.binary.l, counts, visited, common);
+      collectCommonExprs (expr->args.binary.r, counts, visited, common);
+      break;
+    }
+    if (counts.at(expr->index) > 1 && !WeightAlgebra::isOne (expr))
+      common.push_back (expr);
+  }
+}
+
 void Machine::writeJson (ostream& out, bool memoizeRepeatedExpressions, bool showParams, bool useStateIDs) const {
   ExprMemos memo;
   ExprRefCounts counts = WeightAlgebra::zeroRefCounts();
@@ -218,14 +241,9 @@ void Machine::writeJson (ostream& out, bool memoizeRepeatedExpressions, bool sho
 	WeightAlgebra::countRefs (t.weight, counts, params, dummyDefs, NULL);
     }
 
-    auto iter = WeightAlgebra::exprBegin();
-    for (ExprIndex n = 0; n < counts.size(); ++iter, ++n) {
-      const WeightExpr expr = &*iter;
-      if (counts[n] > 1
-	  && expr->type != Dbl && expr->type != Int && expr->type != Param && expr->type != Null
-	  && !WeightAlgebra::isOne (expr))
-	common.push_back (expr);
-    }
+    for (const auto& ms: state)
+      for (const auto& t: ms.trans)
+	collectCommonExprs (t.weight, counts, visited, common);
 
     map<string,string> def2name;
     size_t n = 0;
@@ -561,9 +579,10 @@ Machine Machine::silenceInput() const {
   return m;
 }
 
-Machine Machine::weightInputs (const map<InputSymbol,WeightExpr>& w) const {
+Machine Machine::weightInputs (const map<InputSymbol,WeightExpr>& w, const ExprArenaRefs& wArenas) const {
   Test (!inputEmpty(), "Redundant call to weightInputs(): input alphabet is empty");
   Machine m (*this);
+  m.arenas.insert (wArenas);
   for (auto& ms: m.state)
     for (auto& t: ms.trans)
       if (!t.inputEmpty())
@@ -571,9 +590,10 @@ Machine Machine::weightInputs (const map<InputSymbol,WeightExpr>& w) const {
   return m;
 }
 
-Machine Machine::weightOutputs (const map<OutputSymbol,WeightExpr>& w) const {
+Machine Machine::weightOutputs (const map<OutputSymbol,WeightExpr>& w, const ExprArenaRefs& wArenas) const {
   Test (!outputEmpty(), "Redundant call to weightOutputs(): output alphabet is empty");
   Machine m (*this);
+  m.arenas.insert (wArenas);
   for (auto& ms: m.state)
     for (auto& t: ms.trans)
       if (!t.outputEmpty())
@@ -1697,6 +1717,7 @@ Machine Machine::kleeneLoop (const Machine& main, const Machine& loop) {
   Assert (loop.nStates(), "Attempt to form Kleene closure with uninitialized loop transducer");
   const bool assignStateNames = !main.stateNamesAreAllNull() && !loop.stateNamesAreAllNull();
   Machine m (main);
+  m.retainArenas (loop);
   m.state.reserve (main.nStates() + loop.nStates() + 1);
   for (auto& ms: m.state)
     if (assignStateNames && !ms.name.is_null())
@@ -1868,6 +1889,7 @@ void MachineBoundPath::writeJson (ostream& out) const {
 void Machine::import (const Machine& m, bool overwrite) {
   funcs = ParamAssign (funcs.combine (m.funcs, overwrite));
   cons = cons.combine (m.cons);
+  retainArenas (m);
 }
 
 void Machine::import (const Machine& m1, const Machine& m2, bool overwrite) {
@@ -1875,8 +1897,13 @@ void Machine::import (const Machine& m1, const Machine& m2, bool overwrite) {
   import (m2, overwrite);
 }
 
+void Machine::retainArenas (const Machine& m) {
+  arenas.insert (m.arenas);
+}
+
 Params Machine::getParamDefs (bool assignDefaultValuesToMissingParams) const {
   Params p = funcs;
+  p.arenas.insert (arenas);
   if (assignDefaultValuesToMissingParams)
     p = cons.defaultParams().combine (p, true);
   return p;
@@ -70,6 +70,7 @@ struct Machine {
   ParamFuncs funcs;
   Constraints cons;
   vguard<MachineState> state;
+  ExprArenaRefs arenas;  // keeps the storage for the transition weights (and funcs) alive, including weights copied from other machines
 
   void writeJson (ostream& out, bool memoizeRepeatedExpressions = false, bool showParams = false, bool useStateIDs = false) const;
   void readJson (const json& json);
@@ -153,8 +154,8 @@ struct Machine {
   Machine projectInputToOutput() const;  // copies all input labels to output labels, turning a recognizer into an echoer. Requires outputEmpty()
 
   Machine pointwiseReciprocal() const;
-  Machine weightInputs (const map<InputSymbol,WeightExpr>&) const;
-  Machine weightOutputs (const map<OutputSymbol,WeightExpr>&) const;
+  Machine weightInputs (const map<InputSymbol,WeightExpr>&, const ExprArenaRefs& = ExprArenaRefs()) const;  // the ExprArenaRefs must hold the arenas of the weights (e.g. the arenas of the Params they came from)
+  Machine weightOutputs (const map<OutputSymbol,WeightExpr>&, const ExprArenaRefs& = ExprArenaRefs()) const;
   Machine weightInputs (const string& macro = string(WeightMacroDefaultMacro)) const;
   Machine weightOutputs (const string& macro = string(WeightMacroDefaultMacro)) const;
 
@@ -198,6 +199,7 @@ struct Machine {
   // helpers to import defs & constraints from other machine(s)
   void import (const Machine& m, bool overwrite = false);
   void import (const Machine& m1, const Machine& m2, bool overwrite = false);
+  void retainArenas (const Machine& m);  // for operations that copy m's weights without importing m (import also does this)
 };
 
 typedef JsonLoader<Machine> MachineLoader;
@@ -29,6 +29,7 @@ Params Params::combine (const Params& p, bool overwriteOwnDefs) const {
     } else
       c.defs[name] = def;
   }
+  c.arenas.insert (p.arenas);
   return c;
 }
 
@@ -15,6 +15,7 @@ using json = nlohmann::json;
 class Params {
 public:
   ParamDefs defs;
+  ExprArenaRefs arenas;  // keeps the storage for defs alive, including definitions combined from other Params
   void writeJson (ostream&) const;
   Params combine (const Params& p, bool overwriteOwnDefs = false) const;  // like JavaScript's extend(), param definitions in p will override param defs in this object
   void clear();
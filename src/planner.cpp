@@ -0,0 +1,103 @@
+#include <cmath>
+#include "planner.h"
+#include "scaled.h"
+#include "util.h"
+#include "logger.h"
+
+using namespace MachineBoss;
+
+const char* DPPlan::variantName() const {
+  switch (variant) {
+  case DPVariant::Rolling: return "rolling";
+  case DPVariant::Checkpointed: return "checkpointed";
+  case DPVariant::Full: return "full";
+  default: break;
+  }
+  return "unknown";
+}
+
+DPPlanner::DPPlanner (const EvaluatedMachine& machine, const DPOptions& options, size_t concurrency) :
+  machine (machine),
+  options (options),
+  budget (options.maxMemory / max ((size_t) 1, concurrency)),
+  termsPerCell (machine.incoming.termsPerCell)
+{ }
+
+size_t DPPlanner::cellSize() const {
+  return (options.space == DPSpace::Log && options.cellType == DPCellType::Float) ? sizeof(float) : sizeof(double);
+}
+
+DPPlan DPPlanner::plan (DPTask task, const Envelope& env) const {
+  const size_t nStates = machine.nStates();
+  const size_t rowBytes = (env.inLen + 1) * nStates * sizeof(double);
+  const size_t blockSize = max ((size_t) 1, (size_t) ceil (sqrt ((double) env.outLen)));
+  const size_t checkpointedBytes = (blockSize + 1 + env.outLen / blockSize + 1) * rowBytes;
+  DPPlan p;
+  p.cells = env.nCells() * nStates;
+  const double fillTerms = env.nCells() * termsPerCell;
+  const bool forwardBackward = (task == DPTask::ForwardBackward);
+  const size_t nFull = forwardBackward ? 2 : 1;
+  const size_t fullBytes = nFull * p.cells * (task == DPTask::Sample ? sizeof(double) : cellSize());
+  if (task == DPTask::Score) {
+    p.variant = DPVariant::Rolling;
+    p.bytes = 2 * rowBytes;
+  } else if (fullBytes <= budget || (forwardBackward && options.space == DPSpace::Prob) || task == DPTask::Sample) {
+    p.variant = DPVariant::Full;  // probability-space Forward-Backward, and sampling, have no lower-memory variant
+    p.bytes = fullBytes;
+  } else if (checkpointedBytes + (forwardBackward ? 2 * rowBytes : 0) <= budget || options.scratchDir.empty()) {
+    p.variant = DPVariant::Checkpointed;
+    p.bytes = checkpointedBytes + (forwardBackward ? 2 * rowBytes : 0);
+  } else {
+    p.variant = DPVariant::Full;  // even checkpointing won't fit in RAM, so use out-of-core full matrices
+    p.bytes = fullBytes;
+  }
+  p.terms = fillTerms * nFull * (p.variant == DPVariant::Checkpointed ? 2 : 1);
+  p.fits = p.bytes <= budget || (p.variant == DPVariant::Full && !options.scratchDir.empty());
+  return p;
+}
+
+vguard<DPPlan> DPPlanner::planBatch (DPTask task, const vguard<SeqPair>& seqPairs, const vguard<Envelope>& envs) const {
+  Assert (seqPairs.size() == envs.size(), "Envelope/sequence pair mismatch");
+  vguard<DPPlan> plans;
+  plans.reserve (envs.size());
+  map<DPVariant,size_t> nVariant;
+  size_t maxBytes = 0, nOverBudget = 0;
+  double totalTerms = 0;
+  for (size_t n = 0; n < envs.size(); ++n) {
+    const DPPlan p = plan (task, envs[n]);
+    LogThisAt(4,"DP plan for (" << seqPairs[n].input.name << "," << seqPairs[n].output.name << "): " << p.variantName() << ", " << p.cells << " cells, " << (p.bytes >> 20) << "MB, ~" << p.terms << " terms" << (p.fits ? "" : " (over budget)") << endl);
+    ++nVariant[p.variant];
+    maxBytes = max (maxBytes, p.bytes);
+    totalTerms += p.terms;
+    if (!p.fits)
+      ++nOverBudget;
+    plans.push_back (p);
+  }
+  if (!plans.empty()) {
+    vguard<string> variantCounts;
+    for (const auto& v_n: nVariant) {
+      DPPlan p;
+      p.variant = v_n.first;
+      variantCounts.push_back (to_string(v_n.second) + " " + p.variantName());
+    }
+    LogThisAt(3,"DP plan for " << plural(plans.size(),"sequence pair") << ": " << join(variantCounts,", ") << "; largest needs " << (maxBytes >> 20) << "MB of a " << (budget >> 20) << "MB budget per pair; ~" << totalTerms << " transition terms (" << termsPerCell << " per cell)" << endl);
+  }
+  if (nOverBudget)
+    Warn ("%s will exceed the DP memory budget of %lu MB per pair, even using the lowest-memory DP; consider --auto-band, --dp-scratch, or a larger --max-memory", plural(nOverBudget,"sequence pair").c_str(), budget >> 20);
+  return plans;
+}
+
+vguard<size_t> DPPlanner::smoothOrder (const vguard<DPPlan>& plans) {
+  vguard<size_t> bySize (plans.size());
+  for (size_t n = 0; n < plans.size(); ++n)
+    bySize[n] = n;
+  stable_sort (bySize.begin(), bySize.end(), [&] (size_t a, size_t b) { return plans[a].bytes > plans[b].bytes; });
+  vguard<size_t> order;
+  order.reserve (plans.size());
+  for (size_t i = 0, j = plans.size(); i < j; ) {
+    order.push_back (bySize[i++]);
+    if (i < j)
+      order.push_back (bySize[--j]);
+  }
+  return order;
+}
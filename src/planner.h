@@ -0,0 +1,60 @@
+#ifndef PLANNER_INCLUDED
+#define PLANNER_INCLUDED
+
+#include "dpmatrix.h"
+
+namespace MachineBoss {
+
+// What a DP computation needs from its matrices
+enum class DPTask {
+  Score,  // log-likelihood only (--loglike, or --viterbi without --align)
+  Traceback,  // Viterbi log-likelihood and alignment (--align)
+  ForwardBackward,  // posterior transition probabilities (--counts, --train, --posterior, --mea-align)
+  Sample  // stochastic traceback from a full Forward matrix (--sample-paths)
+};
+
+// DP matrix variants, in increasing order of memory use
+enum class DPVariant {
+  Rolling,  // two output rows
+  Checkpointed,  // a checkpoint row every ~sqrt(outLen) rows, plus one block of rows; roughly twice the compute
+  Full  // every cell
+};
+
+// The planner's choice for one sequence pair, with its estimated cost
+struct DPPlan {
+  DPVariant variant;
+  size_t cells;  // cells of the envelope, times the number of states
+  size_t bytes;  // estimated memory for the DP matrices
+  double terms;  // estimated number of transition terms summed (or maximized) over all fills
+  bool fits;  // true if bytes is within the budget, or the full matrices are out-of-core (see DPOptions::scratchDir)
+  const char* variantName() const;
+};
+
+// Chooses a DP matrix variant for each sequence pair, before any DP is done, to fit the memory budget DPOptions::maxMemory.
+// Sequence pairs that are processed concurrently share the budget.
+// Cells are counted from the envelope (so --auto-band or alignment-restricted envelopes count as banded),
+// and the compute per cell is estimated from the number of transitions into the states that are active for interior cells.
+// Construction is cheap, since that estimate is made once per EvaluatedMachine.
+class DPPlanner {
+public:
+  const EvaluatedMachine& machine;
+  const DPOptions options;
+  const size_t budget;  // bytes per concurrent sequence pair
+  const double termsPerCell;  // mean transition terms per interior (inPos,outPos) cell, summed over active states; precomputed by the machine's incoming EvaluatedTransTable
+
+  DPPlanner (const EvaluatedMachine&, const DPOptions& = DPOptions(), size_t concurrency = 1);
+  DPPlan plan (DPTask, const Envelope&) const;
+
+  // Plans every sequence pair, logging the plan at -v3, and warns up front if any pair cannot fit the budget
+  vguard<DPPlan> planBatch (DPTask, const vguard<SeqPair>&, const vguard<Envelope>&) const;
+
+  // Order in which to process a batch, to smooth peak memory: the largest pairs are interleaved with the smallest,
+  // so that pairs running at the same time are not all large.
+  static vguard<size_t> smoothOrder (const vguard<DPPlan>&);
+
+  size_t cellSize() const;  // bytes per stored cell, from options.space and options.cellType
+};
+
+}  // end namespace
+
+#endif /* PLANNER_INCLUDED */
@@ -0,0 +1,89 @@
+#include "posterior.h"
+#include "logger.h"
+
+using namespace MachineBoss;
+
+PosteriorMatrix::PosteriorMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const Envelope& env, const DPOptions& options) :
+  PosteriorMatrix (machine, seqPair, env, DPPlanner(machine,options).plan(DPTask::ForwardBackward,env).variant, options)
+{ }
+
+PosteriorMatrix::PosteriorMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const Envelope& env, DPVariant variant, const DPOptions& options) :
+  seqPair (seqPair),
+  env (env),
+  inLen (seqPair.input.seq.size()),
+  outLen (seqPair.output.seq.size()),
+  offsets (env.offsets()),
+  matchProb (offsets.back(), 0.)
+{
+  // flag the transitions that consume both an input & an output symbol
+  vguard<vguard<bool> > isMatch (machine.nStates());
+  for (StateIndex s = 0; s < machine.nStates(); ++s) {
+    isMatch[s].resize (machine.state[s].nTransitions, false);
+    for (const auto& in_ost: machine.state[s].outgoing)
+      for (const auto& out_st: in_ost.second)
+	for (const auto& s_t: out_st.second)
+	  isMatch[s][s_t.second.transIndex] = in_ost.first != InputTokenizer::emptyToken() && out_st.first != OutputTokenizer::emptyToken();
+  }
+  // the visitor is called with the cell at which each transition ends
+  logLike = MachineCounts::forwardBackward (machine, seqPair, env, [&] (StateIndex s, EvaluatedMachineState::TransIndex t, InputIndex inPos, OutputIndex outPos, double postProb) {
+      if (isMatch[s][t])
+	matchProb[cellIndex(inPos,outPos)] += postProb;
+    }, variant, options);
+}
+
+SeqPair PosteriorMatrix::meaAlignment() const {
+  // score[cell] = max expected matches of an alignment of input[0..inPos-1] to output[0..outPos-1] within the envelope
+  // A match is only allowed where the posterior is nonzero, so unrelated positions are left as gaps.
+  const double minusInf = -numeric_limits<double>::infinity();
+  vguard<double> score (matchProb.size(), minusInf);
+  auto getScore = [&] (InputIndex inPos, OutputIndex outPos) {
+    return env.contains(inPos,outPos) ? score[cellIndex(inPos,outPos)] : minusInf;
+  };
+  for (OutputIndex outPos = 0; outPos <= outLen; ++outPos)
+    for (InputIndex inPos = env.inStart[outPos]; inPos < env.inEnd[outPos]; ++inPos) {
+      double& sc = score[cellIndex(inPos,outPos)];
+      if (!inPos && !outPos)
+	sc = 0;
+      const double m = match (inPos, outPos);
+      if (m > 0)
+	sc = max (sc, getScore(inPos-1,outPos-1) + m);
+      sc = max (sc, max (getScore(inPos-1,outPos), getScore(inPos,outPos-1)));
+    }
+  Assert (getScore(inLen,outLen) > minusInf, "No MEA alignment within envelope");
+
+  // trace back, preferring matches, then deletions (input only), then insertions (output only)
+  SeqPair::AlignPath path;
+  InputIndex inPos = inLen;
+  OutputIndex outPos = outLen;
+  while (inPos || outPos) {
+    const double sc = getScore (inPos, outPos), m = match (inPos, outPos);
+    if (m > 0 && sc == getScore(inPos-1,outPos-1) + m) {
+      --inPos;
+      --outPos;
+      path.push_front (SeqPair::AlignCol (seqPair.input.seq[inPos], seqPair.output.seq[outPos]));
+    } else if (sc == getScore(inPos-1,outPos)) {
+      --inPos;
+      path.push_front (SeqPair::AlignCol (seqPair.input.seq[inPos], OutputSymbol()));
+    } else {
+      Assert (sc == getScore(inPos,outPos-1), "MEA traceback error");
+      --outPos;
+      path.push_front (SeqPair::AlignCol (InputSymbol(), seqPair.output.seq[outPos]));
+    }
+  }
+  return SeqPair ({ seqPair.input, seqPair.output, path, json::object ({ { "expectedMatches", getScore(inLen,outLen) } }) });
+}
+
+void PosteriorMatrix::writeSparseJson (ostream& out, double threshold) const {
+  out << "{\"input\":\"" << escaped_str(seqPair.input.name)
+      << "\",\"output\":\"" << escaped_str(seqPair.output.name)
+      << "\",\"loglike\":" << toInfinitySafeString(logLike)
+      << ",\"posterior\":[";
+  size_t n = 0;
+  for (OutputIndex outPos = 1; outPos <= outLen; ++outPos)
+    for (InputIndex inPos = max (env.inStart[outPos], (InputIndex) 1); inPos < env.inEnd[outPos]; ++inPos) {
+      const double p = match (inPos, outPos);
+      if (p >= threshold && p > 0)
+	out << (n++ ? "," : "") << "[" << inPos << "," << outPos << "," << p << "]";
+    }
+  out << "]}";
+}
@@ -0,0 +1,45 @@
+#ifndef POSTERIOR_INCLUDED
+#define POSTERIOR_INCLUDED
+
+#include "counts.h"
+
+#define DefaultPosteriorThreshold .01
+
+namespace MachineBoss {
+
+// Posterior probabilities that input & output positions are aligned, from a single Forward-Backward pass.
+// The probability for cell (inPos,outPos) is summed over all transitions that consume both input[inPos-1] and output[outPos-1].
+// Both the sparse posterior output and the maximum expected accuracy (MEA) alignment are derived from these.
+class PosteriorMatrix {
+public:
+  typedef Envelope::InputIndex InputIndex;
+  typedef Envelope::OutputIndex OutputIndex;
+  typedef Envelope::Offset CellIndex;
+
+  const SeqPair& seqPair;
+  const Envelope env;
+  const InputIndex inLen;
+  const OutputIndex outLen;
+  double logLike;
+
+private:
+  const vguard<CellIndex> offsets;
+  vguard<double> matchProb;  // indexed by cellIndex
+
+  inline CellIndex cellIndex (InputIndex inPos, OutputIndex outPos) const {
+    return offsets[outPos] + inPos - env.inStart[outPos];
+  }
+
+public:
+  PosteriorMatrix (const EvaluatedMachine&, const SeqPair&, const Envelope&, const DPOptions& = DPOptions());
+  PosteriorMatrix (const EvaluatedMachine&, const SeqPair&, const Envelope&, DPVariant, const DPOptions& = DPOptions());  // DPVariant chosen by DPPlanner for DPTask::ForwardBackward
+  inline double match (InputIndex inPos, OutputIndex outPos) const {  // probability that input[inPos-1] is aligned to output[outPos-1]
+    return env.contains(inPos,outPos) ? matchProb[cellIndex(inPos,outPos)] : 0;
+  }
+  SeqPair meaAlignment() const;  // maximizes the expected number of correctly aligned pairs; the sum is stored in metadata.expectedMatches
+  void writeSparseJson (ostream&, double threshold) const;  // aligned pairs [inPos,outPos,prob] with prob >= threshold, positions starting at 1
+};
+
+}  // end namespace
+
+#endif /* POSTERIOR_INCLUDED */
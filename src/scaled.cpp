@@ -0,0 +1,99 @@
+#include "scaled.h"
+#include "logger.h"
+
+using namespace MachineBoss;
+
+ScaledBackwardMatrix::ScaledBackwardMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const DPOptions& options) :
+  ScaledDPMatrix (machine, seqPair, Envelope (seqPair), options)
+{
+  fill();
+}
+
+ScaledBackwardMatrix::ScaledBackwardMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const Envelope& env, const DPOptions& options) :
+  ScaledDPMatrix (machine, seqPair, env, options)
+{
+  fill();
+}
+
+void ScaledBackwardMatrix::fill() {
+  ProgressLog(plogDP,6);
+  plogDP.initProgress ("Filling probability-space Backward matrix (%lu cells)", nCellsComputed());
+  CellIndex nCellsDone = 0;
+  for (OutputIndex outPos = outLen; outPos >= 0; --outPos) {
+    // cells in row outPos are computed in units of the cumulative scale factor for row outPos+1
+    const bool endOfOutput = (outPos == outLen);
+    const OutputToken outTok = endOfOutput ? OutputTokenizer::emptyToken() : output[outPos];
+    for (InputIndex inPos = env.inEnd[outPos] - 1; inPos >= env.inStart[outPos]; --inPos) {
+      plogDP.logProgress (nCellsDone / (double) nCellsComputed(), "filled %lu cells", nCellsDone);
+      nCellsDone += nStates;
+      const bool endOfInput = (inPos == inLen);
+      const InputToken inTok = endOfInput ? InputTokenizer::emptyToken() : input[inPos];
+      auto fillState = [&] (StateIndex s) {
+	const bool endState = (s == nStates - 1);
+	double p = (endOfInput && endOfOutput && endState) ? 1 : 0;
+	if (!endOfInput && !endOfOutput)
+	  accumulate (p, machine.outgoing, s, inTok, outTok, inPos + 1, outPos + 1);
+	if (!endOfInput)
+	  accumulate (p, machine.outgoing, s, inTok, OutputTokenizer::emptyToken(), inPos + 1, outPos);
+	if (!endOfOutput)
+	  accumulate (p, machine.outgoing, s, InputTokenizer::emptyToken(), outTok, inPos, outPos + 1);
+	accumulate (p, machine.outgoing, s, InputTokenizer::emptyToken(), OutputTokenizer::emptyToken(), inPos, outPos);
+	cell(inPos,outPos,s) = p;
+      };
+      if (endOfInput && endOfOutput) {  // the end state may have no outgoing transitions, so visit every state
+	for (int s = nStates - 1; s >= 0; --s)
+	  fillState ((StateIndex) s);
+	continue;
+      }
+      const EvaluatedTransTable::Offset begin = machine.outgoing.activeBegin (inTok, outTok);
+      for (EvaluatedTransTable::Offset n = machine.outgoing.activeEnd (inTok, outTok); n > begin; --n)
+	fillState (machine.outgoing.activeState[n-1]);
+    }
+    rescaleRow (outPos, endOfOutput ? 0. : logScale[outPos+1]);
+  }
+}
+
+double ScaledBackwardMatrix::logLike() const {
+  return logCell (0, 0, machine.startState());
+}
+
+void ScaledBackwardMatrix::getCounts (const ScaledForwardMatrix& forward, MachineCounts& counts) const {
+  getCounts (forward, BackwardMatrix::transitionCounter (counts));
+}
+
+// The posterior probability of a transition from (inPos,outPos,src) to (inPos',outPos',dest) is
+//  forward(inPos,outPos,src) * weight * backward(inPos',outPos',dest) / likelihood
+// where the forward and backward cells are stored divided by cumulative row scale factors.
+// The scale factors depend only on outPos and outPos', so they are folded into one multiplier per row.
+void ScaledBackwardMatrix::getCounts (const ScaledForwardMatrix& forward, const BackTransVisitor& transCount) const {
+  ProgressLog(plogDP,6);
+  plogDP.initProgress ("Calculating posterior probabilities (%lu cells)", nCellsComputed());
+  CellIndex nCellsDone = 0;
+  const double ll = forward.logLike();
+  for (OutputIndex outPos = outLen; outPos >= 0; --outPos) {
+    const bool endOfOutput = (outPos == outLen);
+    const OutputToken outTok = endOfOutput ? OutputTokenizer::emptyToken() : output[outPos];
+    const double sameRowScale = exp (forward.rowLogScale(outPos) + logScale[outPos] - ll);
+    const double nextRowScale = endOfOutput ? 0 : exp (forward.rowLogScale(outPos) + logScale[outPos+1] - ll);
+    for (InputIndex inPos = env.inEnd[outPos] - 1; inPos >= env.inStart[outPos]; --inPos) {
+      plogDP.logProgress (nCellsDone / (double) nCellsComputed(), "counted %lu cells", nCellsDone);
+      nCellsDone += nStates;
+      const bool endOfInput = (inPos == inLen);
+      const InputToken inTok = endOfInput ? InputTokenizer::emptyToken() : input[inPos];
+      const EvaluatedTransTable::Offset begin = machine.outgoing.activeBegin (inTok, outTok);
+      for (EvaluatedTransTable::Offset n = machine.outgoing.activeEnd (inTok, outTok); n > begin; --n) {
+	const StateIndex s = machine.outgoing.activeState[n-1];
+	const double fwd = forward.cell(inPos,outPos,s);
+	if (fwd == 0)
+	  continue;
+	if (!endOfInput && !endOfOutput)
+	  accumulateCounts (fwd * nextRowScale, transCount, s, inTok, outTok, inPos + 1, outPos + 1);
+	if (!endOfInput)
+	  accumulateCounts (fwd * sameRowScale, transCount, s, inTok, OutputTokenizer::emptyToken(), inPos + 1, outPos);
+	if (!endOfOutput)
+	  accumulateCounts (fwd * nextRowScale, transCount, s, InputTokenizer::emptyToken(), outTok, inPos, outPos + 1);
+	accumulateCounts (fwd * sameRowScale, transCount, s, InputTokenizer::emptyToken(), OutputTokenizer::emptyToken(), inPos, outPos);
+      }
+    }
+  }
+}
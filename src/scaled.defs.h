@@ -0,0 +1,106 @@
+template<class IndexMapper>
+ScaledDPMatrix<IndexMapper>::ScaledDPMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const Envelope& env, const DPOptions& options) :
+  IndexMapper (env),
+  machine (machine),
+  seqPair (seqPair),
+  input (machine.inputTokenizer.tokenize (seqPair.input.seq)),
+  output (machine.outputTokenizer.tokenize (seqPair.output.seq)),
+  inLen (input.size()),
+  outLen (output.size()),
+  nStates (machine.nStates()),
+  options (options),
+  underflow (false)
+{
+  Assert (IndexMapper::env.fits(seqPair), "Envelope/sequence mismatch:\n%s\n%s\n", JsonWriter<Envelope>::toJsonString(IndexMapper::env).c_str(), JsonWriter<SeqPair>::toJsonString(seqPair).c_str());
+  Assert (IndexMapper::env.connected(), "Envelope is not connected:\n%s\n", JsonWriter<Envelope>::toJsonString(IndexMapper::env).c_str());
+  IndexMapper::preAlloc();
+  LogThisAt(7,"Creating probability-space matrix with " << nCells() << " cells (<=" << (inLen+1) << "*" << (outLen+1) << "*" << nStates << ")" << endl);
+  cellStorage.resize (nCells(), 0., IndexMapper::storesAllCells ? options.scratchDir : string());
+  logScale.resize (outLen + 1, 0.);
+}
+
+template<class IndexMapper>
+void ScaledDPMatrix<IndexMapper>::rescaleRow (OutputIndex outPos, double prevLogScale) {
+  double rowMax = 0;
+  for (InputIndex inPos = IndexMapper::env.inStart[outPos]; inPos < IndexMapper::env.inEnd[outPos]; ++inPos)
+    for (StateIndex s = 0; s < nStates; ++s) {
+      const double c = cell(inPos,outPos,s);
+      if (c > 0 && c < numeric_limits<double>::min())
+	underflow = true;
+      rowMax = max (rowMax, c);
+    }
+  if (rowMax > 0 && rowMax < numeric_limits<double>::infinity()) {
+    const double rowScale = 1. / rowMax;
+    for (InputIndex inPos = IndexMapper::env.inStart[outPos]; inPos < IndexMapper::env.inEnd[outPos]; ++inPos)
+      for (StateIndex s = 0; s < nStates; ++s) {
+	double& c = cell(inPos,outPos,s);
+	c *= rowScale;
+	if (c > 0 && c < numeric_limits<double>::min())
+	  underflow = true;
+      }
+    logScale[outPos] = prevLogScale + log (rowMax);
+  } else
+    logScale[outPos] = prevLogScale;
+}
+
+template<class IndexMapper>
+MappedScaledForwardMatrix<IndexMapper>::MappedScaledForwardMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const DPOptions& options) :
+  ScaledDPMatrix<IndexMapper> (machine, seqPair, Envelope (seqPair), options)
+{
+  fill();
+}
+
+template<class IndexMapper>
+MappedScaledForwardMatrix<IndexMapper>::MappedScaledForwardMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const Envelope& env, const DPOptions& options) :
+  ScaledDPMatrix<IndexMapper> (machine, seqPair, env, options)
+{
+  fill();
+}
+
+template<class IndexMapper>
+void MappedScaledForwardMatrix<IndexMapper>::fill() {
+  typedef ScaledDPMatrix<IndexMapper> DPM;
+  ProgressLog(plogDP,6);
+  plogDP.initProgress ("Filling probability-space Forward matrix (%lu cells)", DPM::nCellsComputed());
+  const StateIndex startState = DPM::machine.startState();
+  typename DPM::CellIndex nCellsDone = 0;
+  for (typename DPM::OutputIndex outPos = 0; outPos <= DPM::outLen; ++outPos) {
+    // cells in row outPos are computed in units of the cumulative scale factor for row outPos-1
+    const OutputToken outTok = outPos ? DPM::output[outPos-1] : OutputTokenizer::emptyToken();
+    for (typename DPM::InputIndex inPos = DPM::env.inStart[outPos]; inPos < DPM::env.inEnd[outPos]; ++inPos) {
+      plogDP.logProgress (nCellsDone / (double) DPM::nCellsComputed(), "filled %lu cells", nCellsDone);
+      nCellsDone += DPM::nStates;
+      const InputToken inTok = inPos ? DPM::input[inPos-1] : InputTokenizer::emptyToken();
+      auto fillState = [&] (StateIndex d) {
+	double p = (inPos || outPos || d != startState) ? 0 : 1;
+	if (inPos && outPos)
+	  DPM::accumulate (p, DPM::machine.incoming, d, inTok, outTok, inPos - 1, outPos - 1);
+	if (inPos)
+	  DPM::accumulate (p, DPM::machine.incoming, d, inTok, OutputTokenizer::emptyToken(), inPos - 1, outPos);
+	if (outPos)
+	  DPM::accumulate (p, DPM::machine.incoming, d, InputTokenizer::emptyToken(), outTok, inPos, outPos - 1);
+	DPM::accumulate (p, DPM::machine.incoming, d, InputTokenizer::emptyToken(), OutputTokenizer::emptyToken(), inPos, outPos);
+	DPM::cell(inPos,outPos,d) = p;
+      };
+      if (!inPos && !outPos) {  // the start state may have no incoming transitions, so visit every state
+	for (StateIndex d = 0; d < DPM::nStates; ++d)
+	  fillState (d);
+	continue;
+      }
+      if (!IndexMapper::storesAllCells)  // storage is reused, so reset the states that are skipped
+	for (StateIndex d = 0; d < DPM::nStates; ++d)
+	  DPM::cell(inPos,outPos,d) = 0;
+      const EvaluatedTransTable& incoming = DPM::machine.incoming;
+      const EvaluatedTransTable::Offset end = incoming.activeEnd (inTok, outTok);
+      for (EvaluatedTransTable::Offset n = incoming.activeBegin (inTok, outTok); n < end; ++n)
+	fillState (incoming.activeState[n]);
+    }
+    DPM::rescaleRow (outPos, outPos ? DPM::logScale[outPos-1] : 0.);
+  }
+}
+
+template<class IndexMapper>
+double MappedScaledForwardMatrix<IndexMapper>::logLike() const {
+  typedef ScaledDPMatrix<IndexMapper> DPM;
+  return DPM::logCell (DPM::inLen, DPM::outLen, DPM::machine.endState());
+}
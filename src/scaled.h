@@ -0,0 +1,121 @@
+#ifndef SCALED_INCLUDED
+#define SCALED_INCLUDED
+
+#include "dpmatrix.h"
+#include "backward.h"
+
+namespace MachineBoss {
+
+// Probability-space DP matrix, with per-output-row rescaling (as in the classic scaled HMM Forward algorithm).
+// Each cell holds a probability divided by a cumulative scale factor for its output row,
+// so the inner loop is a multiply-add, rather than a log_sum_exp.
+// Cells can still underflow if probabilities vary by more than ~300 orders of magnitude within a single output row
+// (e.g. a long input aligned to a short output). The underflow flag reports this, so the caller can redo the DP in log space:
+// it is set wherever a product of nonzero terms is denormal or zero, or a cell is denormal before or after rescaling.
+template<class IndexMapper>
+class ScaledDPMatrix : protected IndexMapper {
+public:
+  typedef typename IndexMapper::InputIndex InputIndex;
+  typedef typename IndexMapper::OutputIndex OutputIndex;
+
+protected:
+  typedef typename IndexMapper::CellIndex CellIndex;
+
+  CellStorage<double> cellStorage;
+  vguard<double> logScale;  // logScale[outPos] = log of cumulative scale factor for row outPos
+
+  inline CellIndex nCells() const {
+    return nStates * IndexMapper::nSuperCells();
+  }
+
+  inline CellIndex nCellsComputed() const {
+    return nStates * IndexMapper::nSuperCellsComputed();
+  }
+
+  inline CellIndex cellIndex (InputIndex inPos, OutputIndex outPos, StateIndex state) const {
+#ifdef USE_VECTOR_GUARDS
+    if (!IndexMapper::env.contains (inPos, outPos))
+      throw runtime_error ("Envelope out-of-bounds access error");
+#endif
+    return IndexMapper::superCellIndex (inPos, outPos) * nStates + state;
+  }
+
+  inline void accumulate (double& p, const EvaluatedTransTable& transTable, StateIndex s, InputToken inTok, OutputToken outTok, InputIndex inPos, OutputIndex outPos) {
+    const EvaluatedTransTable::Offset end = transTable.end (s, inTok, outTok);
+    for (EvaluatedTransTable::Offset n = transTable.begin (s, inTok, outTok); n < end; ++n) {
+      const double c = cell(inPos,outPos,transTable.state[n]), w = transTable.weight[n], term = c * w;
+      if (term < numeric_limits<double>::min() && c > 0 && w > 0)  // the product lost precision, or underflowed to zero
+	underflow = true;
+      p += term;
+    }
+  }
+
+  void rescaleRow (OutputIndex outPos, double prevLogScale);  // divides row by its maximum, sets logScale[outPos], and sets underflow if any cell is denormal before or after rescaling
+
+public:
+  const EvaluatedMachine& machine;
+  const SeqPair& seqPair;
+  const vguard<InputToken> input;
+  const vguard<OutputToken> output;
+  const InputIndex inLen;
+  const OutputIndex outLen;
+  const StateIndex nStates;
+  const DPOptions options;
+  bool underflow;  // true if a product or cell was denormal or underflowed to zero, so some cells may have lost precision
+
+  ScaledDPMatrix (const EvaluatedMachine&, const SeqPair&, const Envelope&, const DPOptions& = DPOptions());
+
+  inline double& cell (InputIndex inPos, OutputIndex outPos, StateIndex state) {
+    return cellStorage[cellIndex(inPos,outPos,state)];
+  }
+
+  inline double cell (InputIndex inPos, OutputIndex outPos, StateIndex state) const {
+    return IndexMapper::env.contains(inPos,outPos) ? cellStorage[cellIndex(inPos,outPos,state)] : 0;
+  }
+
+  inline double rowLogScale (OutputIndex outPos) const { return logScale[outPos]; }
+  inline double logCell (InputIndex inPos, OutputIndex outPos, StateIndex state) const {  // log of the unscaled cell value
+    return log (cell (inPos, outPos, state)) + logScale[outPos];
+  }
+};
+
+template<class IndexMapper>
+class MappedScaledForwardMatrix : public ScaledDPMatrix<IndexMapper> {
+private:
+  void fill();
+public:
+  MappedScaledForwardMatrix (const EvaluatedMachine&, const SeqPair&, const DPOptions& = DPOptions());
+  MappedScaledForwardMatrix (const EvaluatedMachine&, const SeqPair&, const Envelope&, const DPOptions& = DPOptions());
+  double logLike() const;
+  bool mayHaveUnderflowed() const { return this->underflow || logLike() == -numeric_limits<double>::infinity(); }  // if true, the log-space result may differ
+};
+
+typedef MappedScaledForwardMatrix<IdentityIndexMapper> ScaledForwardMatrix;
+typedef MappedScaledForwardMatrix<RollingOutputIndexMapper> RollingOutputScaledForwardMatrix;
+
+class ScaledBackwardMatrix : public ScaledDPMatrix<IdentityIndexMapper> {
+public:
+  typedef BackwardMatrix::BackTransVisitor BackTransVisitor;
+
+private:
+  void fill();
+  inline void accumulateCounts (double scaledFwd, const BackTransVisitor& tv, StateIndex src, InputToken inTok, OutputToken outTok, InputIndex inPos, OutputIndex outPos) const {
+    const EvaluatedTransTable::Offset end = machine.outgoing.end (src, inTok, outTok);
+    for (EvaluatedTransTable::Offset n = machine.outgoing.begin (src, inTok, outTok); n < end; ++n)
+      tv (src, machine.outgoing.transIndex[n], inPos, outPos, scaledFwd * machine.outgoing.weight[n] * cell(inPos,outPos,machine.outgoing.state[n]));
+  }
+
+public:
+  ScaledBackwardMatrix (const EvaluatedMachine&, const SeqPair&, const DPOptions& = DPOptions());
+  ScaledBackwardMatrix (const EvaluatedMachine&, const SeqPair&, const Envelope&, const DPOptions& = DPOptions());
+  void getCounts (const ScaledForwardMatrix&, const BackTransVisitor&) const;
+  void getCounts (const ScaledForwardMatrix&, MachineCounts&) const;
+  double logLike() const;
+  bool mayHaveUnderflowed() const { return underflow || logLike() == -numeric_limits<double>::infinity(); }
+};
+
+#include "scaled.defs.h"
+
+}  // end namespace
+
+#endif /* SCALED_INCLUDED */
@@ -2,6 +2,8 @@
 #include "seqpair.h"
 #include "schema.h"
 #include "util.h"
+#include "fastseq.h"
+#include "logger.h"
 
 using namespace MachineBoss;
 
@@ -88,6 +90,26 @@ SeqPair SeqPair::seqPairFromPath (const MachineBoundPath& mp, const char* inputN
 	json::object ({ { "path", JsonWriter<MachineBoundPath>::toJson (mp) } }) });
 }
 
+SeqPair SeqPair::seqPairFromPath (const MachineBoundPath& mp, const SeqPair& seqPair, size_t inStart, size_t outStart) {
+  const AlignPath aligned = getAlignment (mp);
+  const size_t inEnd = inStart + getInput(aligned).size(), outEnd = outStart + getOutput(aligned).size();
+  Assert (inEnd <= seqPair.input.seq.size() && outEnd <= seqPair.output.seq.size(), "Path does not fit sequence pair");
+  AlignPath alignment;
+  for (size_t i = 0; i < inStart; ++i)
+    alignment.push_back (AlignCol (seqPair.input.seq[i], string()));
+  for (size_t o = 0; o < outStart; ++o)
+    alignment.push_back (AlignCol (string(), seqPair.output.seq[o]));
+  alignment.insert (alignment.end(), aligned.begin(), aligned.end());
+  for (size_t i = inEnd; i < seqPair.input.seq.size(); ++i)
+    alignment.push_back (AlignCol (seqPair.input.seq[i], string()));
+  for (size_t o = outEnd; o < seqPair.output.seq.size(); ++o)
+    alignment.push_back (AlignCol (string(), seqPair.output.seq[o]));
+  return SeqPair ({ seqPair.input,
+	seqPair.output,
+	alignment,
+	json::object ({ { "path", JsonWriter<MachineBoundPath>::toJson (mp) } }) });
+}
+
 SeqPair SeqPair::transpose() const {
   SeqPair tsp;
   tsp.input = output;
@@ -181,6 +203,96 @@ void Envelope::initPathArea (const SeqPair::AlignPath& cols, size_t width) {
   }
 }
 
+// Seeds are k-mers that occur in both input & output.
+// The longest chain of seeds that is increasing in both coordinates is found by patience sorting.
+// Consecutive seeds in the chain (together with the corners of the DP matrix) are then joined by the rectangle between them,
+// so the band includes all paths through the chained seeds; it is then widened by the given width along both the input and output axes.
+// Symbols are mapped to printable characters so that KmerIndex can be used.
+// If there are too many distinct symbols to do this, or there are no seeds, the full envelope is used.
+// If the sequence pair has an alignment, the envelope is just that path, as for Envelope(sp).
+void Envelope::initSeeds (const SeqPair& sp, size_t kmerLen, size_t width) {
+  if (sp.alignment.size()) {
+    initPath (sp.alignment);
+    return;
+  }
+  initFull (sp);
+  map<string,char> symChar;
+  string alphabet;
+  FastSeq inSeq, outSeq;
+  const size_t maxAlphabetSize = FastSeq::qualScoreRange;  // one symbol per printable character
+  auto toFastSeq = [&] (const vguard<string>& syms, FastSeq& fs) {
+    for (const auto& sym: syms) {
+      if (!symChar.count (sym)) {
+	if (alphabet.size() == maxAlphabetSize)
+	  return false;
+	symChar[sym] = FastSeq::minQualityChar + alphabet.size();
+	alphabet.push_back (symChar[sym]);
+      }
+      fs.seq.push_back (symChar[sym]);
+    }
+    return true;
+  };
+  if (!toFastSeq (sp.input.seq, inSeq) || !toFastSeq (sp.output.seq, outSeq)) {
+    LogThisAt(5,"Too many distinct symbols for seed-based banding; using full envelope" << endl);
+    return;
+  }
+  while (kmerLen > 1 && kmerLen * log2 ((double) alphabet.size()) >= 64)  // Kmer must not overflow
+    --kmerLen;
+  if (kmerLen == 0 || inLen < (InputIndex) kmerLen || outLen < (OutputIndex) kmerLen)
+    return;
+
+  // find seeds; for each output position, seeds are visited in decreasing order of input position,
+  // so that at most one seed per output position is chained
+  inSeq.name = sp.input.name;
+  const KmerIndex index (inSeq, alphabet, kmerLen);
+  const TokSeq outTok = outSeq.tokens (alphabet);
+  vguard<pair<InputIndex,OutputIndex> > seed;
+  for (OutputIndex y = 0; y + (OutputIndex) kmerLen <= outLen; ++y) {
+    const auto iter = index.kmerLocations.find (makeKmer (kmerLen, outTok.begin() + y, alphabet.size()));
+    if (iter != index.kmerLocations.end() && iter->second.size() <= MaxSeedKmerOccurrences)
+      for (auto x = iter->second.rbegin(); x != iter->second.rend(); ++x)
+	seed.push_back (pair<InputIndex,OutputIndex> (*x, y));
+  }
+
+  // chain seeds: tail[n] = seed ending the best chain of length n+1 found so far (with the smallest input position)
+  vguard<size_t> tail, prev (seed.size());
+  for (size_t n = 0; n < seed.size(); ++n) {
+    const auto pos = lower_bound (tail.begin(), tail.end(), n, [&] (size_t t, size_t m) { return seed[t].first < seed[m].first; });
+    prev[n] = pos == tail.begin() ? seed.size() : *(pos - 1);
+    if (pos == tail.end())
+      tail.push_back (n);
+    else
+      *pos = n;
+  }
+  vguard<pair<InputIndex,OutputIndex> > anchor;
+  anchor.push_back (pair<InputIndex,OutputIndex> (inLen, outLen));
+  for (size_t n = tail.empty() ? seed.size() : tail.back(); n < seed.size(); n = prev[n])
+    anchor.push_back (seed[n]);
+  anchor.push_back (pair<InputIndex,OutputIndex> (0, 0));
+  reverse (anchor.begin(), anchor.end());
+
+  // band around the chain
+  vguard<InputIndex> lo (outLen + 1, inLen), hi (outLen + 1, 0);
+  for (size_t n = 0; n + 1 < anchor.size(); ++n)
+    for (OutputIndex y = anchor[n].second; y <= anchor[n+1].second; ++y) {
+      lo[y] = min (lo[y], anchor[n].first);
+      hi[y] = max (hi[y], anchor[n+1].first);
+    }
+  const OutputIndex w = width;
+  for (OutputIndex y = 0; y <= outLen; ++y) {
+    inStart[y] = max ((InputIndex) 0, lo[max ((OutputIndex) 0, y - w)] - (InputIndex) width);
+    inEnd[y] = min (inLen, hi[min (outLen, y + w)] + (InputIndex) width) + 1;
+  }
+  LogThisAt(6,"Chained " << (anchor.size() - 2) << " of " << seed.size() << " " << kmerLen << "-mer seeds for " << sp.input.name << " and " << sp.output.name << "; band has " << nCells() << " of " << ((inLen + 1) * (outLen + 1)) << " cells" << endl);
+}
+
+Envelope::Offset Envelope::nCells() const {
+  Offset n = 0;
+  for (OutputIndex y = 0; y <= outLen; ++y)
+    n += inEnd[y] - inStart[y];
+  return n;
+}
+
 bool Envelope::fits (const SeqPair& sp) const {
   return inLen == sp.input.seq.size() && outLen == sp.output.seq.size();
 }
@@ -221,6 +333,12 @@ Envelope Envelope::pathAreaEnvelope (const SeqPair::AlignPath& path, size_t widt
   return env;
 }
 
+Envelope Envelope::seedEnvelope (const SeqPair& sp, size_t kmerLen, size_t width) {
+  Envelope env;
+  env.initSeeds (sp, kmerLen, width);
+  return env;
+}
+
 void Envelope::writeJson (ostream& out) const {
   out << "[";
   for (OutputIndex j = 0; j <= outLen; ++j)
@@ -235,6 +353,13 @@ list<Envelope> SeqPairList::envelopes() const {
   return envs;
 }
 
+list<Envelope> SeqPairList::seedEnvelopes (size_t kmerLen, size_t width) const {
+  list<Envelope> envs;
+  for (const auto& sp: seqPairs)
+    envs.push_back (Envelope::seedEnvelope (sp, kmerLen, width));
+  return envs;
+}
+
 list<Envelope> SeqPairList::envelopes (size_t width) const {
   list<Envelope> envs;
   for (const auto& sp: seqPairs)
@@ -10,6 +10,10 @@
 #define DefaultInputSequenceName "input"
 #define DefaultOutputSequenceName "output"
 
+// Parameters for seed-based banding (Envelope::initSeeds)
+#define DefaultSeedKmerLength 10
+#define MaxSeedKmerOccurrences 16  /* k-mers occurring more often than this in the input are not used as seeds */
+
 namespace MachineBoss {
 
 using namespace std;
@@ -68,6 +72,7 @@ struct SeqPair {
   static vguard<OutputSymbol> getOutput (const AlignPath&);
 
   static SeqPair seqPairFromPath (const MachineBoundPath&, const char* inputName = DefaultInputSequenceName, const char* outputName = DefaultOutputSequenceName);
+  static SeqPair seqPairFromPath (const MachineBoundPath&, const SeqPair& seqPair, size_t inStart, size_t outStart);  // for a path that starts at (inStart,outStart) in seqPair, e.g. a local alignment; pads the alignment with unaligned columns for the rest of seqPair
 
   SeqPair transpose() const;
 };
@@ -104,18 +109,23 @@ struct Envelope {
   void initFull (const SeqPair&);
   void initPath (const SeqPair::AlignPath&);
   void initPathArea (const SeqPair::AlignPath&, size_t width);
+  void initSeeds (const SeqPair&, size_t kmerLen, size_t width);  // band of given width around a chain of k-mers shared by input & output; assumes identical symbols are likely to be aligned. Uses initPath if sp.alignment is nonempty
+
+  Offset nCells() const;  // number of (x,y) cells in the envelope
 
   void writeJson (ostream&) const;
 
   static Envelope fullEnvelope (const SeqPair&);
   static Envelope pathEnvelope (const SeqPair::AlignPath&);
   static Envelope pathAreaEnvelope (const SeqPair::AlignPath&, size_t);
+  static Envelope seedEnvelope (const SeqPair&, size_t kmerLen, size_t width);
 };
 
 struct SeqPairList {
   list<SeqPair> seqPairs;
   list<Envelope> envelopes() const;
   list<Envelope> envelopes (size_t) const;
+  list<Envelope> seedEnvelopes (size_t kmerLen, size_t width) const;
   void readJson (const json&);
   void writeJson (ostream&) const;
 };
@@ -0,0 +1,134 @@
+#include <list>
+#include <condition_variable>
+#include "threadpool.h"
+#include "logger.h"
+
+using namespace MachineBoss;
+
+WorkStealingPool::WorkStealingPool (size_t n) :
+  nThreads (max ((size_t) 1, n)),
+  queue (nThreads)
+{ }
+
+size_t WorkStealingPool::defaultThreads() {
+  const size_t n = thread::hardware_concurrency();
+  return n ? n : 1;
+}
+
+void WorkStealingPool::run (TaskIndex nTasks, const Task& task) {
+  for (TaskIndex n = 0; n < nTasks; ++n)
+    queue[n % nThreads].tasks.push_back (n);
+  exception_ptr err;
+  mutex errMx;
+  atomic<bool> failed (false);
+  list<thread> threads;
+  for (size_t t = 1; t < nThreads && t < nTasks; ++t) {
+    logger.lockSilently();
+    threads.push_back (thread (&WorkStealingPool::runThread, this, t, cref(task), ref(err), ref(errMx), ref(failed)));
+    logger.nameLastThread (threads, "DP");
+    logger.unlockSilently();
+  }
+  runThread (0, task, err, errMx, failed);  // the calling thread takes its share of the work
+  for (auto& thr: threads)
+    thr.join();
+  for (auto& q: queue)
+    q.tasks.clear();
+  if (err)
+    rethrow_exception (err);
+}
+
+// Blocks until all the threads have called wait(); then they all continue. Can be reused
+class PhaseBarrier {
+private:
+  mutex mx;
+  condition_variable cv;
+  const size_t nThreads;
+  size_t nWaiting, generation;
+public:
+  PhaseBarrier (size_t nThreads) : nThreads(nThreads), nWaiting(0), generation(0) { }
+  void wait() {
+    unique_lock<mutex> lock (mx);
+    const size_t gen = generation;
+    if (++nWaiting == nThreads) {
+      nWaiting = 0;
+      ++generation;
+      cv.notify_all();
+    } else
+      cv.wait (lock, [&] { return generation != gen; });
+  }
+};
+
+void WorkStealingPool::runPhases (PhaseIndex nPhases, const PhaseSize& nTasks, const PhaseTask& task) {
+  vector<atomic<TaskIndex> > nextTask (nPhases);
+  for (auto& n: nextTask)
+    n = 0;
+  exception_ptr err;
+  mutex errMx;
+  atomic<bool> failed (false);
+  PhaseBarrier barrier (nThreads);
+  auto work = [&] () {
+    for (PhaseIndex phase = 0; phase < nPhases; ++phase) {
+      const TaskIndex n = nTasks (phase);
+      for (TaskIndex t = nextTask[phase]++; t < n && !failed; t = nextTask[phase]++) {
+	try {
+	  task (phase, t);
+	} catch (...) {
+	  lock_guard<mutex> lock (errMx);
+	  if (!err)
+	    err = current_exception();
+	  failed = true;
+	}
+      }
+      barrier.wait();  // even after a failure, so that no thread is left waiting
+    }
+  };
+  list<thread> threads;
+  for (size_t t = 1; t < nThreads; ++t) {
+    logger.lockSilently();
+    threads.push_back (thread (work));
+    logger.nameLastThread (threads, "DP");
+    logger.unlockSilently();
+  }
+  work();  // the calling thread takes its share of the work
+  for (auto& thr: threads)
+    thr.join();
+  if (err)
+    rethrow_exception (err);
+}
+
+bool WorkStealingPool::popTask (size_t t, TaskIndex& taskIndex) {
+  TaskQueue& q = queue[t];
+  lock_guard<mutex> lock (q.mx);
+  if (q.tasks.empty())
+    return false;
+  taskIndex = q.tasks.front();
+  q.tasks.pop_front();
+  return true;
+}
+
+bool WorkStealingPool::stealTask (size_t t, TaskIndex& taskIndex) {
+  for (size_t k = 1; k < nThreads; ++k) {
+    TaskQueue& q = queue[(t + k) % nThreads];
+    lock_guard<mutex> lock (q.mx);
+    if (!q.tasks.empty()) {
+      taskIndex = q.tasks.back();
+      q.tasks.pop_back();
+      return true;
+    }
+  }
+  return false;
+}
+
+void WorkStealingPool::runThread (size_t t, const Task& task, exception_ptr& err, mutex& errMx, atomic<bool>& failed) {
+  TaskIndex taskIndex;
+  while (!failed && (popTask (t, taskIndex) || stealTask (t, taskIndex))) {
+    try {
+      task (taskIndex);
+    } catch (...) {
+      lock_guard<mutex> lock (errMx);
+      if (!err)
+	err = current_exception();
+      failed = true;
+    }
+  }
+}
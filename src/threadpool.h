@@ -0,0 +1,55 @@
+#ifndef THREADPOOL_INCLUDED
+#define THREADPOOL_INCLUDED
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <vector>
+#include <atomic>
+#include <exception>
+
+namespace MachineBoss {
+
+using namespace std;
+
+// Work-stealing thread pool for a batch of independent tasks, indexed 0..nTasks-1.
+// Tasks are initially dealt out round-robin to per-thread deques; each thread pops tasks from the front of its own deque,
+// and when that runs dry, steals from the back of the other threads' deques.
+// Tasks should write their results to a slot indexed by the task, so that the caller can report them in input order.
+class WorkStealingPool {
+public:
+  typedef size_t TaskIndex;
+  typedef function<void(TaskIndex)> Task;
+
+  typedef size_t PhaseIndex;
+  typedef function<TaskIndex(PhaseIndex)> PhaseSize;
+  typedef function<void(PhaseIndex,TaskIndex)> PhaseTask;
+
+  WorkStealingPool (size_t nThreads);
+  void run (TaskIndex nTasks, const Task& task);  // blocks until all tasks are done. Rethrows the first exception thrown by any task
+
+  // Runs a sequence of phases, each a batch of independent tasks that must all finish before the next phase starts.
+  // The threads are started once, not once per phase; they claim the tasks of each phase from a shared counter,
+  // then wait at a barrier for the other threads. Blocks until all phases are done. Rethrows the first exception thrown by any task
+  void runPhases (PhaseIndex nPhases, const PhaseSize& nTasks, const PhaseTask& task);
+
+  static size_t defaultThreads();  // number of hardware threads, or 1 if unknown
+
+private:
+  struct TaskQueue {
+    mutex mx;
+    deque<TaskIndex> tasks;
+  };
+
+  const size_t nThreads;
+  vector<TaskQueue> queue;  // not vguard, since mutex is not copyable
+
+  bool popTask (size_t thread, TaskIndex& taskIndex);
+  bool stealTask (size_t thread, TaskIndex& taskIndex);
+  void runThread (size_t thread, const Task& task, exception_ptr& err, mutex& errMx, atomic<bool>& failed);
+};
+
+}  // end namespace
+
+#endif /* THREADPOOL_INCLUDED */
@@ -3,49 +3,95 @@
 
 using namespace MachineBoss;
 
-ViterbiMatrix::ViterbiMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair) :
-  DPMatrix (machine, seqPair)
+template<class IndexMapper,class Cell>
+MappedViterbiMatrix<IndexMapper,Cell>::MappedViterbiMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const DPOptions& options) :
+  DPM (machine, seqPair, options)
 {
   fill();
 }
 
-ViterbiMatrix::ViterbiMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const Envelope& env) :
-  DPMatrix (machine, seqPair, env)
+template<class IndexMapper,class Cell>
+MappedViterbiMatrix<IndexMapper,Cell>::MappedViterbiMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const Envelope& env, const DPOptions& options) :
+  DPM (machine, seqPair, env, options)
 {
   fill();
 }
 
-void ViterbiMatrix::fill() {
-  ProgressLog(plogDP,6);
-  plogDP.initProgress ("Filling Viterbi matrix (%lu cells)", nCellsComputed());
-  CellIndex nCellsDone = 0;
-  for (OutputIndex outPos = 0; outPos <= outLen; ++outPos) {
-    const OutputToken outTok = outPos ? output[outPos-1] : OutputTokenizer::emptyToken();
-    for (InputIndex inPos = env.inStart[outPos]; inPos < env.inEnd[outPos]; ++inPos, ++nCellsDone) {
-      const InputToken inTok = inPos ? input[inPos-1] : InputTokenizer::emptyToken();
-      for (StateIndex d = 0; d < nStates; ++d) {
-	plogDP.logProgress (nCellsDone / (double) nCellsComputed(), "filled %lu cells", nCellsDone);
-	++nCellsDone;
-	const EvaluatedMachineState& state = machine.state[d];
-	double ll = (inPos || outPos || d) ? -numeric_limits<double>::infinity() : 0;
-	if (inPos && outPos)
-	  accumulate (ll, state.incoming, inTok, outTok, inPos - 1, outPos - 1, max_reduce);
-	if (inPos)
-	  accumulate (ll, state.incoming, inTok, OutputTokenizer::emptyToken(), inPos - 1, outPos, max_reduce);
-	if (outPos)
-	  accumulate (ll, state.incoming, InputTokenizer::emptyToken(), outTok, inPos, outPos - 1, max_reduce);
-	accumulate (ll, state.incoming, InputTokenizer::emptyToken(), OutputTokenizer::emptyToken(), inPos, outPos, max_reduce);
-	cell(inPos,outPos,d) = ll;
-      }
-    }
-  }
-  LogThisAt(8,"Viterbi matrix:" << endl << *this);
+template<class IndexMapper,class Cell>
+MappedViterbiMatrix<IndexMapper,Cell>::MappedViterbiMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const Envelope& env, const PruningSettings& pruning, const DPOptions& options) :
+  DPM (machine, seqPair, env, options)
+{
+  fill (pruning);
+}
+
+template<class IndexMapper,class Cell>
+void MappedViterbiMatrix<IndexMapper,Cell>::fill (const PruningSettings& pruning) {
+  if (pruning.enabled() || IndexMapper::diagonalOrder)
+    DPM::template fillIncomingPruned<MaxSemiring> (DPM::machine.startState(), pruning.xDrop, "Viterbi");
+  else
+    DPM::template fillIncoming<MaxSemiring> (DPM::machine.startState(), "Viterbi");
+}
+
+template<class IndexMapper,class Cell>
+double MappedViterbiMatrix<IndexMapper,Cell>::logLike() const {
+  if (DPM::options.local.enabled())
+    return DPM::template terminusLogLike<MaxSemiring>();
+  return DPM::cell (DPM::inLen, DPM::outLen, DPM::machine.endState());
+}
+
+template<class IndexMapper,class Cell>
+MachinePath MappedViterbiMatrix<IndexMapper,Cell>::path (const Machine& m) const {
+  return DPM::traceBack (m);
 }
 
-double ViterbiMatrix::logLike() const {
-  return cell (inLen, outLen, machine.endState());
+template<class IndexMapper,class Cell>
+MachinePath MappedViterbiMatrix<IndexMapper,Cell>::path (const Machine& m, typename DPM::InputIndex& inStart, typename DPM::OutputIndex& outStart) const {
+  return DPM::traceBack (m, inStart, outStart);
+}
+
+template class MachineBoss::MappedViterbiMatrix<IdentityIndexMapper,double>;
+template class MachineBoss::MappedViterbiMatrix<IdentityIndexMapper,float>;
+template class MachineBoss::MappedViterbiMatrix<RollingOutputIndexMapper,double>;
+template class MachineBoss::MappedViterbiMatrix<RollingDiagonalIndexMapper,double>;
+
+CheckpointedViterbiMatrix::CheckpointedViterbiMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const DPOptions& options) :
+  CheckpointedDPMatrix (machine, seqPair, Envelope (seqPair), "Viterbi", options)
+{ }
+
+CheckpointedViterbiMatrix::CheckpointedViterbiMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const Envelope& env, const DPOptions& options) :
+  CheckpointedDPMatrix (machine, seqPair, env, "Viterbi", options)
+{ }
+
+// Traceback proceeds within the current block until it reaches the block's first row;
+// the previous block is then recomputed from its checkpoint, and the traceback resumes.
+// A local alignment ends in the row with the best terminus, so only that row's block is needed to find where it ends.
+MachinePath CheckpointedViterbiMatrix::path (const Machine& m, InputIndex& inPos, OutputIndex& outPos) {
+  MachinePath path;
+  inPos = inLen;
+  outPos = outLen;
+  StateIndex state = machine.endState();
+  if (options.local.enabled()) {
+    const OutputIndex endRow = max_element (terminus.begin(), terminus.end()) - terminus.begin();
+    loadBlock (endRow);
+    selectTerminus (false, endRow, endRow, inPos, outPos, selectMaxTrans);
+  }
+  const TraceTerminator stopTrace = [&] (InputIndex i, OutputIndex o, StateIndex s, EvaluatedMachineState::TransIndex ti) {
+    path.trans.push_front (m.state[s].getTransition (ti));
+    inPos = i;
+    outPos = o;
+    state = s;
+    return o > 0 && o == outBegin;
+  };
+  bool done = false;
+  while (!done) {
+    loadBlock (outPos);
+    done = traceBack (m, inPos, outPos, state, stopTrace);
+  }
+  return path;
 }
 
-MachinePath ViterbiMatrix::path (const Machine& m) const {
-  return traceBack (m);
+MachinePath CheckpointedViterbiMatrix::path (const Machine& m) {
+  InputIndex inStart;
+  OutputIndex outStart;
+  return path (m, inStart, outStart);
 }
@@ -5,15 +5,39 @@
 
 namespace MachineBoss {
 
-class ViterbiMatrix : public DPMatrix<IdentityIndexMapper> {
+// Cell is the storage type for cells; the instantiations are in viterbi.cpp.
+// path() requires an IndexMapper that stores all cells.
+template<class IndexMapper, class Cell = double>
+class MappedViterbiMatrix : public DPMatrix<IndexMapper,Cell> {
+public:
+  typedef DPMatrix<IndexMapper,Cell> DPM;
+
 private:
-  void fill();
+  void fill (const PruningSettings& = PruningSettings());
   
 public:
-  ViterbiMatrix (const EvaluatedMachine&, const SeqPair&);
-  ViterbiMatrix (const EvaluatedMachine&, const SeqPair&, const Envelope&);
+  MappedViterbiMatrix (const EvaluatedMachine&, const SeqPair&, const DPOptions& = DPOptions());
+  MappedViterbiMatrix (const EvaluatedMachine&, const SeqPair&, const Envelope&, const DPOptions& = DPOptions());
+  MappedViterbiMatrix (const EvaluatedMachine&, const SeqPair&, const Envelope&, const PruningSettings&, const DPOptions& = DPOptions());  // if pruned is set, logLike() is a lower bound
   double logLike() const;
   MachinePath path (const Machine&) const;
+  MachinePath path (const Machine&, typename DPM::InputIndex& inStart, typename DPM::OutputIndex& outStart) const;  // also returns the cell where the path starts, which is (0,0) unless local alignment is enabled
+};
+
+typedef MappedViterbiMatrix<IdentityIndexMapper> ViterbiMatrix;
+typedef MappedViterbiMatrix<IdentityIndexMapper,float> FloatViterbiMatrix;
+typedef MappedViterbiMatrix<RollingOutputIndexMapper> RollingOutputViterbiMatrix;  // score only
+typedef MappedViterbiMatrix<RollingDiagonalIndexMapper> RollingDiagonalViterbiMatrix;  // score only, filled by anti-diagonals (e.g. for X-drop pruning)
+
+// Viterbi alignment in O(sqrt(outLen)) rows of memory.
+// The traceback recomputes the rows between consecutive checkpoints one block at a time, last block first.
+// Cell values are identical to those of ViterbiMatrix, so path() returns the same MachinePath.
+class CheckpointedViterbiMatrix : public CheckpointedDPMatrix<MaxSemiring> {
+public:
+  CheckpointedViterbiMatrix (const EvaluatedMachine&, const SeqPair&, const DPOptions& = DPOptions());
+  CheckpointedViterbiMatrix (const EvaluatedMachine&, const SeqPair&, const Envelope&, const DPOptions& = DPOptions());
+  MachinePath path (const Machine&);  // not const, as it overwrites the current block
+  MachinePath path (const Machine&, InputIndex& inStart, OutputIndex& outStart);  // also returns the cell where the path starts
 };
 
 }  // end namespace
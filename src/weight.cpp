@@ -1,5 +1,10 @@
 #include <math.h>
 #include <list>
+#include <unordered_map>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <thread>
 #include <iomanip>
 #include "weight.h"
 #include "parsers.h"
@@ -9,43 +14,104 @@
 
 using namespace MachineBoss;
 
-// singleton for storing ExprStruct's
-class ExprStructFactory {
+namespace MachineBoss {
+
+// key for hash-consing ExprStruct's: the type, and the arguments as raw bits
+struct ExprKey {
+  ExprType type;
+  uint64_t l, r;
+  ExprKey (ExprType type, uint64_t l, uint64_t r = 0) : type(type), l(l), r(r) { }
+  bool operator== (const ExprKey& k) const { return type == k.type && l == k.l && r == k.r; }
+};
+
+struct ExprKeyHash {
+  size_t operator() (const ExprKey& k) const {
+    size_t h = hash<uint64_t>() (k.l);
+    h ^= hash<uint64_t>() (k.r) + 0x9e3779b97f4a7c15 + (h << 6) + (h >> 2);
+    h ^= hash<int>() (k.type) + 0x9e3779b97f4a7c15 + (h << 6) + (h >> 2);
+    return h;
+  }
+};
+
+// one thread's storage within an ExprArena
+// Nodes are hash-consed: within a heap, there is only ever one node for a given (type,args), so structurally identical expressions
+// built by the same thread in the same arena are pointer-identical.
+// Since the arguments of a node are themselves interned, the arguments can be compared by pointer.
+class ExprHeap {
 private:
-  list<ExprStruct> exprStructStorage;
-  list<string> paramStorage;
-  ExprIndex nExprStructs;
+  static const size_t BlockSize = 4096;  // ExprStruct's per block
+  vguard<unique_ptr<ExprStruct[]> > block;
+  size_t nUsedInLastBlock;
+  ExprIndex lastBlockIndex;  // ExprIndex of the first ExprStruct in the last block
+  atomic<size_t> nExprs;  // read by other threads, via ExprArena::size()
+  unordered_map<string,ExprPtr> paramExpr;  // also owns the parameter names
+  unordered_map<ExprKey,ExprPtr,ExprKeyHash> internedExpr;
+
+  // ExprIndex's are unique across all arenas and threads.
+  // Each block reserves a range of indices, so this is only touched once per block
+  static atomic<ExprIndex> nExprStructs;
+
+  static uint64_t ptrBits (ExprPtr e) { return (uint64_t) (uintptr_t) e; }
+  static uint64_t doubleBits (double d) { uint64_t b; memcpy (&b, &d, sizeof(b)); return b; }
+
+  // returns the interned node for key, or a new node (with the given type) if there isn't one yet
+  ExprStruct* intern (const ExprKey& key, bool& isNew) {
+    auto iter = internedExpr.find (key);
+    isNew = iter == internedExpr.end();
+    if (!isNew)
+      return (ExprStruct*) iter->second;
+    ExprStruct* e = newExpr();
+    e->type = key.type;
+    internedExpr[key] = e;
+    return e;
+  }
+  ExprStruct* newExpr() {
+    if (block.empty() || nUsedInLastBlock == BlockSize) {
+      block.push_back (unique_ptr<ExprStruct[]> (new ExprStruct[BlockSize]));
+      nUsedInLastBlock = 0;
+      lastBlockIndex = nExprStructs.fetch_add (BlockSize, memory_order_relaxed);
+    }
+    ExprStruct* result = &block.back()[nUsedInLastBlock];
+    result->index = lastBlockIndex + nUsedInLastBlock++;
+    nExprs.fetch_add (1, memory_order_relaxed);
+    return result;
+  }
+
 public:
   ExprPtr zero, one;
-  ExprStructFactory() {
-    nExprStructs = 0;
-    zero = newExpr();
-    one = newExpr();
-    ((ExprStruct*)zero)->type = ((ExprStruct*)one)->type = Int;
-    ((ExprStruct*)zero)->args.intValue = 0;
-    ((ExprStruct*)one)->args.intValue = 1;
+  // The first heap of the global arena makes the canonical zero and one; all other heaps share them
+  ExprHeap (ExprPtr globalZero, ExprPtr globalOne) :
+    nUsedInLastBlock (0),
+    lastBlockIndex (0),
+    nExprs (0)
+  {
+    if (globalZero) {
+      zero = internedExpr[ExprKey (Int, 0)] = globalZero;
+      one = internedExpr[ExprKey (Int, 1)] = globalOne;
+    } else {
+      zero = newInt (0);
+      one = newInt (1);
+    }
   }
-  ExprPtr newExpr() {
-    exprStructStorage.push_front (ExprStruct());
-    ExprPtr result = &exprStructStorage.front();
-    ((ExprStruct*)result)->index = nExprStructs++;
-    return result;
+  // safe to call while the owning thread is allocating
+  size_t size() const {
+    return nExprs.load (memory_order_relaxed);
   }
   ExprPtr newParam (const string& param) {
-    paramStorage.push_front (param);
-    ExprPtr e = newExpr();
-    ((ExprStruct*)e)->type = Param;
-    ((ExprStruct*)e)->args.param = &paramStorage.front();
+    auto iter = paramExpr.find (param);
+    if (iter != paramExpr.end())
+      return iter->second;
+    iter = paramExpr.insert (make_pair (param, newExpr())).first;
+    ExprStruct* e = (ExprStruct*) iter->second;
+    e->type = Param;
+    e->args.param = (string*) &iter->first;
     return e;
   }
   ExprPtr newInt (int val) {
-    if (val == 0)
-      return zero;
-    if (val == 1)
-      return one;
-    ExprPtr e = newExpr();
-    ((ExprStruct*)e)->type = Int;
-    ((ExprStruct*)e)->args.intValue = val;
+    bool isNew;
+    ExprStruct* e = intern (ExprKey (Int, (uint64_t) (int64_t) val), isNew);
+    if (isNew)
+      e->args.intValue = val;
     return e;
   }
   ExprPtr newDouble (double val) {
@@ -53,65 +119,302 @@ public:
       return zero;
     if (val == 1.)
       return one;
-    ExprPtr e = newExpr();
-    ((ExprStruct*)e)->type = Dbl;
-    ((ExprStruct*)e)->args.doubleValue = val;
+    bool isNew;
+    ExprStruct* e = intern (ExprKey (Dbl, doubleBits (val)), isNew);
+    if (isNew)
+      e->args.doubleValue = val;
     return e;
   }
   ExprPtr newUnary (ExprType type, ExprPtr arg) {
     Assert (arg, "Null argument to unary function");
-    ExprPtr e = newExpr();
-    ((ExprStruct*)e)->type = type;
-    ((ExprStruct*)e)->args.arg = arg;
+    bool isNew;
+    ExprStruct* e = intern (ExprKey (type, ptrBits (arg)), isNew);
+    if (isNew)
+      e->args.arg = arg;
     return e;
   }
   ExprPtr newBinary (ExprType type, ExprPtr l, ExprPtr r) {
     Assert (l && r, "Null argument to binary function");
-    ExprPtr e = newExpr();
-    ((ExprStruct*)e)->type = type;
-    ((ExprStruct*)e)->args.binary.l = l;
-    ((ExprStruct*)e)->args.binary.r = r;
+    bool isNew;
+    ExprStruct* e = intern (ExprKey (type, ptrBits (l), ptrBits (r)), isNew);
+    if (isNew) {
+      e->args.binary.l = l;
+      e->args.binary.r = r;
+    }
     return e;
   }
-  ExprRefCounts zeroRefCounts() const {
-    return ExprRefCounts (nExprStructs, 0);
+};
+
+atomic<ExprIndex> ExprHeap::nExprStructs (0);
+
+// The heaps of one ExprArena.
+// A heap is used by one thread at a time. When a thread exits, its heaps are returned to their pools as idle,
+// to be adopted by the next thread that needs one, so the number of heaps is bounded by the peak number of threads
+// concurrently building expressions in the arena. (A heap's nodes can't be freed when its thread exits, since they may still be in use.)
+class ExprHeapPool {
+private:
+  mutable mutex poolMutex;
+  vguard<unique_ptr<ExprHeap> > heap;
+  vguard<ExprHeap*> idle;
+  ExprPtr zero, one;  // NULL until the global arena's first heap has made them
+public:
+  ExprHeapPool (ExprPtr zero, ExprPtr one) : zero(zero), one(one) { }
+  ExprHeap* acquire() {
+    lock_guard<mutex> lock (poolMutex);
+    if (!idle.empty()) {
+      ExprHeap* h = idle.back();
+      idle.pop_back();
+      return h;
+    }
+    heap.push_back (unique_ptr<ExprHeap> (new ExprHeap (zero, one)));
+    ExprHeap* h = heap.back().get();
+    zero = h->zero;
+    one = h->one;
+    return h;
+  }
+  void release (ExprHeap* h) {
+    lock_guard<mutex> lock (poolMutex);
+    idle.push_back (h);
+  }
+  size_t size() const {
+    lock_guard<mutex> lock (poolMutex);
+    size_t n = 0;
+    for (const auto& h: heap)
+      n += h->size();
+    return n;
   }
-  ExprIter exprBegin() const {
-    return exprStructStorage.begin();
+};
+
+// The heaps that the calling thread has acquired, keyed by the serial number of their ExprStructFactory.
+// The pools are weakly referenced, so that arenas can be freed while threads that used them are still running.
+class ThreadHeaps {
+private:
+  struct Entry {
+    weak_ptr<ExprHeapPool> pool;
+    ExprHeap* heap;
+  };
+  unordered_map<uint64_t,Entry> entry;
+  uint64_t lastSerial;  // most recently used, to skip the lookup when a thread stays in one arena
+  ExprHeap* lastHeap;
+public:
+  ThreadHeaps() : lastSerial(0), lastHeap(NULL) { }
+  ~ThreadHeaps() {
+    for (auto& serial_entry: entry) {
+      const shared_ptr<ExprHeapPool> pool = serial_entry.second.pool.lock();
+      if (pool)
+	pool->release (serial_entry.second.heap);
+    }
+  }
+  ExprHeap& heap (uint64_t serial, const shared_ptr<ExprHeapPool>& pool) {
+    if (serial != lastSerial) {
+      auto iter = entry.find (serial);
+      if (iter == entry.end()) {
+	// forget heaps in arenas that have since been freed, so this map only holds live arenas
+	for (auto it = entry.begin(); it != entry.end(); )
+	  if (it->second.pool.expired())
+	    it = entry.erase (it);
+	  else
+	    ++it;
+	Entry e;
+	e.pool = pool;
+	e.heap = pool->acquire();
+	iter = entry.insert (make_pair (serial, e)).first;
+      }
+      lastSerial = serial;
+      lastHeap = iter->second.heap;
+    }
+    return *lastHeap;
+  }
+};
+
+// storage for the ExprStruct's of one ExprArena: a heap for each thread that builds expressions in the arena.
+// Creating an expression only touches the calling thread's heap. The pool's lock is only taken when a thread first uses the arena,
+// and the thread's own map of heaps is only searched when it switches between arenas.
+class ExprStructFactory {
+private:
+  const uint64_t serial;  // unique to this factory, so that a thread's heap can't be confused with that of a deleted factory at the same address
+  const shared_ptr<ExprHeapPool> pool;
+
+  static atomic<uint64_t> nFactories;
+
+public:
+  ExprPtr zero, one;
+
+  ExprStructFactory (const ExprStructFactory* global) :
+    serial (++nFactories),
+    pool (make_shared<ExprHeapPool> (global ? global->zero : NULL, global ? global->one : NULL))
+  {
+    ExprHeap& h = threadHeap();
+    zero = h.zero;
+    one = h.one;
+  }
+
+  ExprHeap& threadHeap() {
+    thread_local ThreadHeaps threadHeaps;
+    return threadHeaps.heap (serial, pool);
   }
+
+  size_t size() const {
+    return pool->size();
+  }
+
+  static ExprHeap& current();  // the calling thread's heap in its current arena
 };
-ExprStructFactory factory;
+
+atomic<uint64_t> ExprStructFactory::nFactories (0);
+
+// The global arena is created on first use, and deliberately never destroyed, so that it outlives any static Machine's.
+// Each thread has its own current arena, which is the global arena until the thread opens a scope.
+static thread_local shared_ptr<ExprArena> currentArena;
+
+}  // end namespace
+
+const shared_ptr<ExprArena>& ExprArena::globalArena() {
+  static const shared_ptr<ExprArena>* arena = new shared_ptr<ExprArena> (new ExprArena (true));
+  return *arena;
+}
+
+ExprHeap& ExprStructFactory::current() {
+  return (currentArena ? currentArena : ExprArena::globalArena())->factory->threadHeap();
+}
+
+ExprArena::ExprArena() :
+  factory (new ExprStructFactory (globalArena()->factory.get())),
+  parent (current())
+{ }
+
+ExprArena::ExprArena (bool) :
+  factory (new ExprStructFactory (NULL))
+{ }
+
+ExprArena::~ExprArena()
+{ }
+
+size_t ExprArena::size() const {
+  return factory->size();
+}
+
+shared_ptr<ExprArena> ExprArena::global() {
+  return globalArena();
+}
+
+shared_ptr<ExprArena> ExprArena::current() {
+  return currentArena ? currentArena : globalArena();
+}
+
+ExprArenaScope::ExprArenaScope (const shared_ptr<ExprArena>& arena) :
+  arena (arena),
+  previous (currentArena)
+{
+  currentArena = arena;
+}
+
+ExprArenaScope::~ExprArenaScope() {
+  currentArena = previous;
+}
+
+ExprArenaRefs::ExprArenaRefs() {
+  arenas.insert (ExprArena::current());
+}
+
+ExprArenaRefs::ExprArenaRefs (const ExprArenaRefs& refs) :
+  arenas (refs.arenas)
+{
+  arenas.insert (ExprArena::current());
+}
+
+ExprArenaRefs::ExprArenaRefs (ExprArenaRefs&& refs) :
+  arenas (move (refs.arenas))
+{
+  arenas.insert (ExprArena::current());
+}
+
+ExprArenaRefs& ExprArenaRefs::operator= (const ExprArenaRefs& refs) {
+  arenas = refs.arenas;
+  arenas.insert (ExprArena::current());
+  return *this;
+}
+
+ExprArenaRefs& ExprArenaRefs::operator= (ExprArenaRefs&& refs) {
+  arenas = move (refs.arenas);
+  arenas.insert (ExprArena::current());
+  return *this;
+}
+
+void ExprArenaRefs::insert (const ExprArenaRefs& refs) {
+  arenas.insert (refs.arenas.begin(), refs.arenas.end());
+}
+
+static ExprHeap& factory() {
+  return ExprStructFactory::current();
+}
 
 WeightExpr WeightAlgebra::zero() {
-  return factory.zero;
+  return factory().zero;
 }
 
 WeightExpr WeightAlgebra::one() {
-  return factory.one;
+  return factory().one;
 }
 
 WeightExpr WeightAlgebra::intConstant (int value) {
-  return value == 0 ? factory.zero : (value == 1 ? factory.one : factory.newInt (value));
+  return value == 0 ? factory().zero : (value == 1 ? factory().one : factory().newInt (value));
 }
 
 WeightExpr WeightAlgebra::doubleConstant (double value) {
-  return value == 0. ? factory.zero : (value == 1. ? factory.one : factory.newDouble (value));
+  return value == 0. ? factory().zero : (value == 1. ? factory().one : factory().newDouble (value));
 }
 
 WeightExpr WeightAlgebra::param (const string& name) {
-  return factory.newParam (name);
+  return factory().newParam (name);
+}
+
+// Constant folding.
+// A numeric result is folded into a constant, unless it is not finite (e.g. division by zero, or overflow),
+// in which case the expression is kept. Operations on two Int's yield an Int if the result is an integer that fits in one.
+static WeightExpr foldedConstant (double result, bool intOperands) {
+  if (!isfinite (result))
+    return NULL;
+  return (intOperands && result == floor(result) && fabs(result) <= (double) numeric_limits<int>::max())
+    ? factory().newInt ((int) result)
+    : factory().newDouble (result);
+}
+
+// returns NULL if either operand is not numeric, or the result is not finite
+static WeightExpr foldBinary (ExprType op, const WeightExpr& l, const WeightExpr& r) {
+  if (!WeightAlgebra::isNumber(l) || !WeightAlgebra::isNumber(r))
+    return NULL;
+  const double x = WeightAlgebra::asDouble(l), y = WeightAlgebra::asDouble(r);
+  double result = 0;
+  switch (op) {
+  case Mul: result = x * y; break;
+  case Div: result = x / y; break;
+  case Add: result = x + y; break;
+  case Sub: result = x - y; break;
+  case Pow: result = pow (x, y); break;
+  default: Abort ("Unknown opcode in foldBinary"); break;
+  }
+  return foldedConstant (result, l->type == Int && r->type == Int);
+}
+
+static WeightExpr foldUnary (ExprType op, const WeightExpr& arg) {
+  if (!WeightAlgebra::isNumber(arg))
+    return NULL;
+  const double x = WeightAlgebra::asDouble(arg);
+  return foldedConstant (op == Log ? log(x) : exp(x), false);
 }
 
 WeightExpr WeightAlgebra::minus (const WeightExpr& x) {
-  return factory.newBinary (Sub, factory.zero, x);
+  const WeightExpr folded = foldBinary (Sub, factory().zero, x);
+  return folded ? folded : factory().newBinary (Sub, factory().zero, x);
 }
 
 WeightExpr WeightAlgebra::negate (const WeightExpr& p) {
-  return subtract (factory.one, p);
+  return subtract (factory().one, p);
 }
 
 WeightExpr WeightAlgebra::reciprocal (const WeightExpr& p) {
-  return divide (factory.one, p);
+  return divide (factory().one, p);
 }
 
 WeightExpr WeightAlgebra::geometricSum (const WeightExpr& p) {
@@ -119,19 +422,45 @@ WeightExpr WeightAlgebra::geometricSum (const WeightExpr& p) {
 }
 
 WeightExpr WeightAlgebra::subtract (const WeightExpr& l, const WeightExpr& r) {
-  return isZero(r) ? l : factory.newBinary (Sub, l, r);
+  WeightExpr w = NULL;
+  if (isZero(r))
+    w = l;
+  else if (!(w = foldBinary (Sub, l, r)))
+    w = factory().newBinary (Sub, l, r);
+  return w;
 }
 
 WeightExpr WeightAlgebra::power (const WeightExpr& a, const WeightExpr& b) {
-  return isOne(b) ? a : (isZero(b) ? factory.one : factory.newBinary (Pow, a, b));
+  WeightExpr w = NULL;
+  if (isOne(b))
+    w = a;
+  else if (isZero(b) || isOne(a))
+    w = factory().one;
+  else if (!(w = foldBinary (Pow, a, b)))
+    w = factory().newBinary (Pow, a, b);
+  return w;
 }
 
 WeightExpr WeightAlgebra::logOf (const WeightExpr& p) {
-  return isOne(p) ? factory.zero : (p->type == Exp ? p->args.arg : factory.newUnary (Log, p));
+  WeightExpr w = NULL;
+  if (isOne(p))
+    w = factory().zero;
+  else if (p->type == Exp)
+    w = p->args.arg;
+  else if (!(w = foldUnary (Log, p)))
+    w = factory().newUnary (Log, p);
+  return w;
 }
 
 WeightExpr WeightAlgebra::expOf (const WeightExpr& p) {
-  return isZero(p) ? factory.one : (p->type == Log ? p->args.arg : factory.newUnary (Exp, p));
+  WeightExpr w = NULL;
+  if (isZero(p))
+    w = factory().one;
+  else if (p->type == Log)
+    w = p->args.arg;
+  else if (!(w = foldUnary (Exp, p)))
+    w = factory().newUnary (Exp, p);
+  return w;
 }
 
 WeightExpr WeightAlgebra::multiply (const WeightExpr& l, const WeightExpr& r) {
@@ -141,13 +470,9 @@ WeightExpr WeightAlgebra::multiply (const WeightExpr& l, const WeightExpr& r) {
   else if (isOne(r))
     w = l;
   else if (isZero(l) || isZero(r))
-    w = factory.zero;
-  else if (l->type == Int && r->type == Int)
-    w = factory.newInt (l->args.intValue * r->args.intValue);
-  else if (isNumber(l) && isNumber(r))
-    w = factory.newDouble (asDouble(l) * asDouble(r));
-  else
-    w = factory.newBinary (Mul, l, r);
+    w = factory().zero;
+  else if (!(w = foldBinary (Mul, l, r)))
+    w = factory().newBinary (Mul, l, r);
   return w;
 }
 
@@ -156,11 +481,11 @@ WeightExpr WeightAlgebra::divide (const WeightExpr& l, const WeightExpr& r) {
   if (isOne(r))
     w = l;
   else if (isZero(l))
-    w = factory.zero;
-  else if (isNumber(l) && isNumber(r) && (l->type == Dbl || r->type == Dbl))
-    w = factory.newDouble (asDouble(l) / asDouble(r));
-  else
-    w = factory.newBinary (Div, l, r);
+    w = factory().zero;
+  else if (isOne(l) && r->type == Div && isOne(r->args.binary.l))
+    w = r->args.binary.r;  // 1/(1/x) = x
+  else if (!(w = foldBinary (Div, l, r)))
+    w = factory().newBinary (Div, l, r);
   return w;
 }
 
@@ -172,21 +497,17 @@ WeightExpr WeightAlgebra::add (const WeightExpr& l, const WeightExpr& r) {
     w = l;
   else if (r->type == Sub && isZero(r->args.binary.l))
     w = subtract (l, r->args.binary.r);
-  else if (l->type == Int && r->type == Int)
-    w = factory.newInt (l->args.intValue + r->args.intValue);
-  else if (isNumber(l) && isNumber(r))
-    w = factory.newDouble (asDouble(l) + asDouble(r));
-  else
-    w = factory.newBinary (Add, l, r);
+  else if (!(w = foldBinary (Add, l, r)))
+    w = factory().newBinary (Add, l, r);
   return w;
 }
 
 bool WeightAlgebra::isZero (const WeightExpr& w) {
-  return w == factory.zero || (w->type == Int && w->args.intValue == 0) || (w->type == Dbl && w->args.doubleValue == 0.);
+  return w == factory().zero || (w->type == Int && w->args.intValue == 0) || (w->type == Dbl && w->args.doubleValue == 0.);
 }
 
 bool WeightAlgebra::isOne (const WeightExpr& w) {
-  return w == factory.one || (w->type == Int && w->args.intValue == 1) || (w->type == Dbl && w->args.doubleValue == 1.);
+  return w == factory().one || (w->type == Int && w->args.intValue == 1) || (w->type == Dbl && w->args.doubleValue == 1.);
 }
 
 bool WeightAlgebra::isNumber (const WeightExpr& w) {
@@ -228,11 +549,23 @@ WeightExpr WeightAlgebra::bind (const WeightExpr& w, const ParamDefs& defs) {
     }
     break;
   case Log:
+    result = logOf (bind (w->args.arg, defs));
+    break;
   case Exp:
-    result = factory.newUnary (op, bind (w->args.arg, defs));
+    result = expOf (bind (w->args.arg, defs));
     break;
   default:
-    result = factory.newBinary (op, bind (w->args.binary.l, defs), bind (w->args.binary.r, defs));
+    {
+      const WeightExpr l = bind (w->args.binary.l, defs), r = bind (w->args.binary.r, defs);
+      switch (op) {
+      case Mul: result = multiply (l, r); break;
+      case Add: result = add (l, r); break;
+      case Sub: result = subtract (l, r); break;
+      case Div: result = divide (l, r); break;
+      case Pow: result = power (l, r); break;
+      default: Abort ("Unknown opcode in bind"); break;
+      }
+    }
     break;
   }
   return result;
@@ -306,17 +639,17 @@ WeightExpr WeightAlgebra::deriv (const WeightExpr& w, const ParamDefs& defs, con
   case Null:
   case Int:
   case Dbl:
-    d = factory.zero;
+    d = factory().zero;
     break;
   case Param:
     {
       const string& n (*w->args.param);
       if (param == n)
-	d = factory.one;
+	d = factory().one;
       else if (defs.count(n))
 	d = deriv (defs.at(n), exclude(defs,n), param);
       else
-	d = factory.zero;
+	d = factory().zero;
     }
     break;
   case Exp:
@@ -549,14 +882,14 @@ WeightExpr WeightAlgebra::fromJson (const json& w, const ParamDefs* defs) {
  if (w.is_null())
    result = WeightExpr();
  else if (w.is_boolean())
-   result = w.get<bool>() ? factory.one : factory.zero;
+   result = w.get<bool>() ? factory().one : factory().zero;
  else if (w.is_number_integer())
-   result = factory.newInt (w.get<int>());
+   result = factory().newInt (w.get<int>());
  else if (w.is_number())
-   result = factory.newDouble (w.get<double>());
+   result = factory().newDouble (w.get<double>());
  else if (w.is_string()) {
    const string name = w.get<string>();
-   result = defs && defs->count(name) ? defs->at(name) : factory.newParam(name);
+   result = defs && defs->count(name) ? defs->at(name) : factory().newParam(name);
  } else if (w.is_array())
     Abort ("Unexpected type in WeightExpr: array");
  else {
@@ -590,11 +923,7 @@ WeightExpr WeightAlgebra::fromJson (const json& w, const ParamDefs* defs) {
 }
 
 ExprRefCounts WeightAlgebra::zeroRefCounts() {
-  return factory.zeroRefCounts();
-}
-
-ExprIter WeightAlgebra::exprBegin() {
-  return factory.exprBegin();
+  return ExprRefCounts();
 }
 
 void WeightAlgebra::countRefs (const WeightExpr w, ExprRefCounts& counts, set<string>& params, const ParamDefs& defs, const WeightExpr parent) {
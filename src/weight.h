@@ -3,6 +3,8 @@
 
 #include <list>
 #include <set>
+#include <memory>
+#include <unordered_map>
 #include "json.hpp"
 
 #define WeightMacroSymbolPlaceholder       "%"
@@ -17,7 +19,6 @@ using json = nlohmann::json;
 
 typedef struct ExprStruct const* ExprPtr;
 typedef size_t ExprIndex;
-typedef list<ExprStruct>::const_iterator ExprIter;
 
 struct BinaryExprArgs {
   ExprPtr l, r;
@@ -46,9 +47,59 @@ struct ExprStruct {
 };
 
 typedef ExprPtr WeightExpr;
+
+// Storage for ExprStruct's.
+// Expressions are created in the current arena, which is the process-lifetime global arena unless an ExprArenaScope is active.
+// Nodes are allocated in contiguous blocks and hash-consed within the arena, and are all released together when the last
+// reference to the arena (from an ExprArenaScope, a Machine, or an arena created within its scope) is dropped.
+// An arena keeps alive the arena that was current when it was created, so its expressions may refer to expressions from enclosing scopes;
+// expressions from other arenas must not be combined with it unless something else keeps those arenas alive.
+// Expressions may be created concurrently: the current arena is per-thread, and each thread allocates (and hash-conses) in its own heap
+// within an arena, so threads building expressions in the same arena do not contend, though they may create duplicate nodes.
+// When a thread exits, its heaps are handed on to later threads, so thread churn does not grow an arena.
+// Expressions are immutable once created, and may be shared freely between threads.
+class ExprStructFactory;
+class ExprArena {
+private:
+  unique_ptr<ExprStructFactory> factory;
+  shared_ptr<ExprArena> parent;
+  ExprArena (bool);  // the global arena
+  static const shared_ptr<ExprArena>& globalArena();
+  friend class ExprStructFactory;
+public:
+  ExprArena();
+  ~ExprArena();
+  size_t size() const;  // number of ExprStruct's allocated in this arena
+  static shared_ptr<ExprArena> current();  // the calling thread's current arena
+  static shared_ptr<ExprArena> global();
+};
+
+// Makes an arena (by default, a new one) current for the calling thread, until this object goes out of scope
+class ExprArenaScope {
+private:
+  shared_ptr<ExprArena> arena, previous;
+public:
+  ExprArenaScope (const shared_ptr<ExprArena>& arena = make_shared<ExprArena>());
+  ~ExprArenaScope();
+};
+
+// The arenas that a set of expressions (e.g. a Machine's weights) may point into, kept alive together.
+// Copying also adds the arena that is current at the time of the copy, since the copy may then be given new expressions.
+class ExprArenaRefs {
+private:
+  set<shared_ptr<ExprArena> > arenas;
+public:
+  ExprArenaRefs();  // holds the current arena
+  ExprArenaRefs (const ExprArenaRefs&);
+  ExprArenaRefs (ExprArenaRefs&&);
+  ExprArenaRefs& operator= (const ExprArenaRefs&);
+  ExprArenaRefs& operator= (ExprArenaRefs&&);
+  void insert (const ExprArenaRefs&);
+  bool contains (const shared_ptr<ExprArena>& arena) const { return arenas.count (arena) > 0; }
+};
 typedef map<string,WeightExpr> ParamDefs;
 
-typedef vector<size_t> ExprRefCounts;
+typedef unordered_map<ExprIndex,size_t> ExprRefCounts;
 typedef map<WeightExpr,string> ExprMemos;
 
 struct WeightAlgebra {
@@ -110,7 +161,6 @@ struct WeightAlgebra {
   // trace refcount of functions. also used by params()
   static ExprRefCounts zeroRefCounts();
   static void countRefs (const WeightExpr w, ExprRefCounts& counts, set<string>& params, const ParamDefs& defs, const WeightExpr parent = NULL);
-  static ExprIter exprBegin();
 };
 
 }  // end namespace
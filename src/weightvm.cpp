@@ -0,0 +1,137 @@
+#include <math.h>
+#include <cstring>
+#include "weightvm.h"
+#include "util.h"
+
+using namespace MachineBoss;
+
+typedef WeightProgram::Register Register;
+
+// Compiles expressions into a WeightProgram, in dependency order.
+// Registers are assigned once (by ExprStruct for subexpressions, by name for parameters, by value for constants), and never overwritten.
+class WeightCompiler {
+private:
+  WeightProgram& prog;
+  const ParamDefs& defs;
+  map<ExprPtr,Register> exprRegister;
+  map<string,Register> paramRegister;
+  map<uint64_t,Register> constRegister;  // keyed by bit pattern, so -0 and 0 (and NaNs) are kept distinct
+  set<string> expanding;  // parameters whose definitions are being compiled; as in WeightAlgebra::eval, these are undefined within their own definitions
+
+  Register newRegister (double init = 0) {
+    prog.initRegister.push_back (init);
+    return prog.initRegister.size() - 1;
+  }
+
+  Register emit (ExprType op, Register l, Register r) {
+    const Register dest = newRegister();
+    const WeightProgram::Instruction instr = { op, dest, l, r };
+    prog.code.push_back (instr);
+    return dest;
+  }
+
+  Register constant (double value) {
+    uint64_t bits;
+    memcpy (&bits, &value, sizeof(bits));
+    const auto iter = constRegister.find (bits);
+    if (iter != constRegister.end())
+      return iter->second;
+    return constRegister[bits] = newRegister (value);
+  }
+
+public:
+  WeightCompiler (WeightProgram& prog, const ParamDefs& defs) :
+    prog (prog),
+    defs (defs)
+  { }
+
+  Register slot (const string& name) {
+    const Register reg = newRegister();
+    prog.slotName.push_back (name);
+    prog.slotRegister.push_back (reg);
+    return paramRegister[name] = reg;
+  }
+
+  Register param (const string& name) {
+    const auto iter = paramRegister.find (name);
+    if (iter != paramRegister.end())
+      return iter->second;
+    if (expanding.count (name))
+      throw runtime_error (string("Parameter ") + name + (" not defined"));
+    if (!defs.count (name))
+      return slot (name);
+    expanding.insert (name);
+    const Register reg = compile (defs.at (name));
+    expanding.erase (name);
+    return paramRegister[name] = reg;
+  }
+
+  Register compile (const WeightExpr w) {
+    const auto iter = exprRegister.find (w);
+    if (iter != exprRegister.end())
+      return iter->second;
+    Register reg;
+    switch (w->type) {
+    case Null:
+      reg = constant (0);
+      break;
+    case Int:
+    case Dbl:
+      reg = constant (WeightAlgebra::asDouble (w));
+      break;
+    case Param:
+      reg = param (*w->args.param);
+      break;
+    case Log:
+    case Exp:
+      reg = emit (w->type, compile (w->args.arg), 0);
+      break;
+    default:
+      {
+	const Register l = compile (w->args.binary.l);
+	const Register r = compile (w->args.binary.r);
+	reg = emit (w->type, l, r);
+      }
+      break;
+    }
+    return exprRegister[w] = reg;
+  }
+};
+
+WeightProgram::WeightProgram (const vguard<WeightExpr>& exprs, const ParamDefs& defs, const vguard<string>& slots) {
+  WeightCompiler compiler (*this, defs);
+  for (const auto& name: slots)
+    compiler.slot (name);
+  resultRegister.reserve (exprs.size());
+  for (const auto& w: exprs)
+    resultRegister.push_back (compiler.compile (w));
+}
+
+void WeightProgram::run (const vguard<double>& slotValue, vguard<double>& reg) const {
+  if (slotValue.size() < nSlots())
+    throw runtime_error (string("Parameter ") + slotName[slotValue.size()] + (" not defined"));
+  reg = initRegister;
+  for (size_t n = 0; n < nSlots(); ++n)
+    reg[slotRegister[n]] = slotValue[n];
+  double* r = reg.data();
+  for (const auto& instr: code)
+    switch (instr.op) {
+    case Mul: r[instr.dest] = r[instr.l] * r[instr.r]; break;
+    case Div: r[instr.dest] = r[instr.l] / r[instr.r]; break;
+    case Add: r[instr.dest] = r[instr.l] + r[instr.r]; break;
+    case Sub: r[instr.dest] = r[instr.l] - r[instr.r]; break;
+    case Pow: r[instr.dest] = pow (r[instr.l], r[instr.r]); break;
+    case Log: r[instr.dest] = log (r[instr.l]); break;
+    case Exp: r[instr.dest] = exp (r[instr.l]); break;
+    default: Abort ("Unknown opcode"); break;
+    }
+}
+
+vguard<double> WeightProgram::run (const vguard<double>& slotValue) const {
+  vguard<double> reg, result;
+  run (slotValue, reg);
+  result.reserve (resultRegister.size());
+  for (auto n: resultRegister)
+    result.push_back (reg[n]);
+  return result;
+}
@@ -0,0 +1,41 @@
+#ifndef WEIGHTVM_INCLUDED
+#define WEIGHTVM_INCLUDED
+
+#include "weight.h"
+#include "vguard.h"
+
+namespace MachineBoss {
+
+// Register bytecode for evaluating many WeightExprs in one pass.
+// The compiler flattens the expressions into straight-line code with one register per distinct subexpression,
+// so subexpressions (and parameters) shared between the expressions are evaluated only once per run.
+// Parameters that are defined in the ParamDefs are compiled inline, as WeightAlgebra::eval would evaluate them;
+// all other parameters are assigned integer slots, whose values are passed to run().
+class WeightProgram {
+public:
+  typedef unsigned int Register;
+  struct Instruction {
+    ExprType op;  // Mul, Add, Sub, Div or Pow (binary); Log or Exp (unary, r unused)
+    Register dest, l, r;
+  };
+
+  vguard<string> slotName;  // slotName[slot] = name of the parameter in that slot
+  vguard<Register> slotRegister;
+  vguard<double> initRegister;  // initial register values (constants, and zero for everything else)
+  vguard<Instruction> code;
+  vguard<Register> resultRegister;  // resultRegister[n] holds the value of the n'th compiled WeightExpr
+
+  WeightProgram() { }
+  // Parameters named in slots get the first slots, in that order, even if they are defined in defs
+  WeightProgram (const vguard<WeightExpr>& exprs, const ParamDefs& defs = ParamDefs(), const vguard<string>& slots = vguard<string>());
+
+  size_t nSlots() const { return slotName.size(); }
+  size_t nRegisters() const { return initRegister.size(); }
+
+  void run (const vguard<double>& slotValue, vguard<double>& reg) const;  // reg is working storage, reused between runs
+  vguard<double> run (const vguard<double>& slotValue = vguard<double>()) const;  // returns the value of each compiled WeightExpr
+};
+
+}  // end namespace
+
+#endif /* WEIGHTVM_INCLUDED */
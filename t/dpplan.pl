@@ -0,0 +1,19 @@
+#!/usr/bin/env perl
+
+use warnings;
+use IPC::Open3;
+
+die "Usage: $0 <prog> <args...>" unless @ARGV >= 1;
+my ($prog, @args) = @ARGV;
+
+# runs prog (which should log at -v3 or higher), and prints only the DPPlanner summary, without terminal color codes
+my $pid = open3(\*CHILD_IN, \*CHILD_OUT, \*CHILD_ERR,
+		$prog, @args);
+
+close CHILD_IN;
+my @out = <CHILD_OUT>;
+my @err = <CHILD_ERR>;
+waitpid ($pid, 0);
+
+grep s/\e\[[\d;]*m//g, @err;
+print grep (/^DP plan for \d+ sequence pair/, @err);
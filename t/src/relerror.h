@@ -0,0 +1,20 @@
+#ifndef RELERROR_INCLUDED
+#define RELERROR_INCLUDED
+
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+
+// Relative error |x-y|/max(1,|x|,|y|), used by the DP comparison tests (testprecision, testincremental, testrolling)
+inline double relativeError (double x, double y) {
+  if (x == y)
+    return 0;
+  return std::abs (x - y) / std::max (1., std::max (std::abs (x), std::abs (y)));
+}
+
+// prints "<label>: ok" to stdout if the error is within tolerance, "<label>: not ok" otherwise
+inline void reportRelativeError (const char* label, double err, double maxErr) {
+  std::cout << label << ": " << (err <= maxErr ? "ok" : "not ok") << std::endl;
+}
+
+#endif /* RELERROR_INCLUDED */
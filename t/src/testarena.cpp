@@ -0,0 +1,64 @@
+#include <iostream>
+#include "../../src/machine.h"
+#include "../../src/eval.h"
+
+using namespace std;
+using namespace MachineBoss;
+
+int main (int argc, char** argv) {
+  if (argc != 3) {
+    cerr << "Usage: " << argv[0] << " machine.json params.json" << endl;
+    exit(1);
+  }
+  Machine m;
+  weak_ptr<ExprArena> weakArena;
+  {
+    ExprArenaScope scope;
+    weakArena = ExprArena::current();
+    const Machine single = MachineLoader::fromFile (argv[1]);
+    m = Machine::compose (single, single);
+    cout << "machine " << (m.arenas.contains (weakArena.lock()) ? "holds" : "does not hold") << " session arena" << endl;
+    cout << "session arena " << (weakArena.lock()->size() ? "has" : "has no") << " expressions" << endl;
+  }
+  m.writeJson (cout);
+  cout << "after scope, session arena is " << (weakArena.expired() ? "released" : "retained") << endl;
+  m = Machine();
+  cout << "after machine is discarded, session arena is " << (weakArena.expired() ? "released" : "retained") << endl;
+
+  // build an operand in a session, combine it with a machine from the global arena outside the session, then drop the operand
+  Machine combined;
+  {
+    unique_ptr<Machine> operand;
+    {
+      ExprArenaScope scope;
+      weakArena = ExprArena::current();
+      operand.reset (new Machine (Machine::concatenate (MachineLoader::fromFile (argv[1]), MachineLoader::fromFile (argv[1]))));
+    }
+    combined = Machine::compose (*operand, MachineLoader::fromFile (argv[1]));
+  }
+  cout << "after the operand is discarded, session arena is " << (weakArena.expired() ? "released" : "retained by the combined machine") << endl;
+  combined.writeJson (cout);
+  combined = Machine();
+  cout << "after the combined machine is discarded, session arena is " << (weakArena.expired() ? "released" : "retained") << endl;
+
+  // load params in a session, then evaluate a machine with them, and weight a machine's inputs with them, after the session has ended
+  Machine weighted;
+  {
+    unique_ptr<Params> params;
+    {
+      ExprArenaScope scope;
+      weakArena = ExprArena::current();
+      params.reset (new Params (JsonLoader<ParamAssign>::fromFile (argv[2])));
+    }
+    cout << "after scope, session arena is " << (weakArena.expired() ? "released" : "retained by the params") << endl;
+    const EvaluatedMachine eval (MachineLoader::fromFile (argv[1]), *params);
+    eval.writeJson (cout);
+    const map<InputSymbol,WeightExpr> inputWeights = { { "0", params->defs.at("p") }, { "1", params->defs.at("q") } };
+    weighted = MachineLoader::fromFile (argv[1]).weightInputs (inputWeights, params->arenas);
+  }
+  cout << "after the params are discarded, session arena is " << (weakArena.expired() ? "released" : "retained by the weighted machine") << endl;
+  weighted.writeJson (cout);
+  weighted = Machine();
+  cout << "after the weighted machine is discarded, session arena is " << (weakArena.expired() ? "released" : "retained") << endl;
+  exit(0);
+}
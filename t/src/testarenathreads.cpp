@@ -0,0 +1,67 @@
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include "../../src/machine.h"
+
+using namespace std;
+using namespace MachineBoss;
+
+// Builds the same composite machine on several threads at once, half of them in a shared session arena
+// and half in the global arena, and checks that they all agree with a machine built on the main thread.
+// Then builds it on many short-lived threads, one after another, in another arena, and checks that the arena
+// does not grow: each thread should adopt the heap (and so the nodes) of the thread before it.
+int main (int argc, char** argv) {
+  if (argc != 3) {
+    cerr << "Usage: " << argv[0] << " machine.json nThreads" << endl;
+    exit(1);
+  }
+  const string filename (argv[1]);
+  const size_t nThreads = atoi (argv[2]);
+
+  auto build = [&] () -> string {
+    const Machine single = MachineLoader::fromFile (filename);
+    Machine m = single;
+    for (int n = 0; n < 4; ++n)
+      m = Machine::compose (m, single);
+    ostringstream out;
+    m.writeJson (out, true);
+    return out.str();
+  };
+  const string expected = build();
+
+  const shared_ptr<ExprArena> session = make_shared<ExprArena>();
+  vguard<string> result (nThreads);
+  vguard<thread> threads;
+  for (size_t n = 0; n < nThreads; ++n)
+    threads.push_back (thread ([&,n] () {
+      if (n % 2) {
+	ExprArenaScope scope (session);
+	result[n] = build();
+      } else
+	result[n] = build();
+    }));
+  for (auto& t: threads)
+    t.join();
+
+  size_t nMatch = 0;
+  for (const auto& r: result)
+    if (r == expected)
+      ++nMatch;
+  cout << nMatch << " of " << nThreads << " threads built the same machine" << endl;
+
+  const shared_ptr<ExprArena> churn = make_shared<ExprArena>();
+  auto buildInThread = [&] () {
+    thread t ([&] () {
+      ExprArenaScope scope (churn);
+      (void) build();
+    });
+    t.join();
+  };
+  buildInThread();
+  const size_t sizeAfterOne = churn->size();
+  const size_t nChurn = 10 * nThreads;
+  for (size_t n = 1; n < nChurn; ++n)
+    buildInThread();
+  cout << "Arena built on " << nChurn << " sequential threads " << (churn->size() == sizeAfterOne ? "is the same size as" : "is larger than") << " one built on one thread" << endl;
+  exit(0);
+}
@@ -0,0 +1,21 @@
+#include <fstream>
+#include "../../src/params.h"
+#include "../../src/schema.h"
+#include "../../src/weightvm.h"
+
+using namespace MachineBoss;
+
+int main (int argc, char** argv) {
+  if (argc != 3) {
+    cerr << "Usage: " << argv[0] << " expr.json params.json" << endl;
+    exit(1);
+  }
+  json w;
+  ifstream in (argv[1]);
+  in >> w;
+  MachineSchema::validateOrDie ("expr", w);
+  Params p = JsonLoader<ParamAssign>::fromFile (argv[2]);
+  const WeightProgram prog (vguard<WeightExpr> (1, WeightAlgebra::fromJson(w)), p.defs);
+  cout << prog.run().front() << endl;
+  exit(0);
+}
@@ -0,0 +1,28 @@
+#include <fstream>
+#include <iostream>
+#include "../../src/machine.h"
+#include "../../src/schema.h"
+
+using namespace std;
+using namespace MachineBoss;
+
+// Builds the same expression twice, checks that the two copies are the same node,
+// and uses them as the weights of two transitions, so that --define-exprs gives them one shared definition.
+int main (int argc, char** argv) {
+  if (argc != 2) {
+    cerr << "Usage: " << argv[0] << " expr.json" << endl;
+    exit(1);
+  }
+  json w;
+  ifstream in (argv[1]);
+  in >> w;
+  MachineSchema::validateOrDie ("expr", w);
+  const WeightExpr a = WeightAlgebra::fromJson (w), b = WeightAlgebra::fromJson (w);
+  cout << "separately built copies are " << (a == b ? "the same node" : "different nodes") << endl;
+  Machine m;
+  m.state.resize (2);
+  m.state[0].trans.push_back (MachineTransition (string("x"), string(), 1, a));
+  m.state[0].trans.push_back (MachineTransition (string("y"), string(), 1, b));
+  m.writeJson (cout, true);
+  exit(0);
+}
@@ -0,0 +1,70 @@
+#include "../../src/forward.h"
+#include "relerror.h"
+
+using namespace MachineBoss;
+
+// Compares IncrementalForwardMatrix with ForwardMatrix.
+// Each output sequence is appended in chunks of 1, 2, 3, ... tokens; after each chunk, endLogLike() should match the Forward log-likelihood of the output so far,
+// and prefixLogLike() should match the sum, over the last row of the Forward matrix, of the transitions that emit the last output token.
+// Prints "ok" or "not ok" to stdout for each; the log-likelihoods go to stderr.
+
+#define DefaultMaxLogLikeError 1e-9
+
+// sum over paths that end with the transition emitting the last output token, using the EvaluatedMachineState transition maps
+double prefixLogLike (const EvaluatedMachine& eval, const ForwardMatrix& fwd) {
+  if (!fwd.outLen)
+    return 0;
+  const OutputToken outTok = fwd.output.back();
+  double ll = -numeric_limits<double>::infinity();
+  for (ForwardMatrix::InputIndex inPos = 0; inPos <= fwd.inLen; ++inPos)
+    for (StateIndex d = 0; d < eval.nStates(); ++d) {
+      const EvaluatedMachineState::InOutStateTransMap& incoming = eval.state[d].incoming;
+      auto addTerms = [&] (InputToken inTok, ForwardMatrix::InputIndex srcInPos) {
+	if (incoming.count (inTok) && incoming.at(inTok).count (outTok))
+	  for (const auto& st: incoming.at(inTok).at(outTok))
+	    ll = log_sum_exp (ll, fwd.cell (srcInPos, fwd.outLen - 1, st.first) + st.second.logWeight);
+      };
+      if (inPos)
+	addTerms (fwd.input[inPos-1], inPos - 1);
+      addTerms (InputTokenizer::emptyToken(), inPos);
+    }
+  return ll;
+}
+
+int main (int argc, char** argv) {
+  if (argc < 4 || argc > 5) {
+    cerr << "Usage: " << argv[0] << " machine.json params.json seqpairlist.json [maxLogLikeError]" << endl;
+    exit(1);
+  }
+  Machine machine = MachineLoader::fromFile (argv[1]);
+  Params params = JsonLoader<ParamAssign>::fromFile (argv[2]);
+  SeqPairList seqPairs = JsonLoader<SeqPairList>::fromFile (argv[3]);
+  const double maxLogLikeErr = argc > 4 ? atof (argv[4]) : DefaultMaxLogLikeError;
+  EvaluatedMachine eval (machine, params);
+
+  double err = 0, prefixErr = 0;
+  for (const auto& seqPair: seqPairs.seqPairs) {
+    IncrementalForwardMatrix incFwd (eval, seqPair.input.seq);
+    const vguard<OutputSymbol>& output = seqPair.output.seq;
+    for (size_t outLen = 0, chunk = 1; true; outLen += chunk++) {
+      outLen = min (outLen, output.size());
+      incFwd.appendOutput (vguard<OutputSymbol> (output.begin() + incFwd.outputLength(), output.begin() + outLen));
+      SeqPair prefixPair (seqPair);
+      prefixPair.output.seq = vguard<OutputSymbol> (output.begin(), output.begin() + outLen);
+      const ForwardMatrix fwd (eval, prefixPair);
+      const double fwdPrefixLogLike = prefixLogLike (eval, fwd);
+      cerr << seqPair.input.name << " " << seqPair.output.name << " " << outLen
+	   << " forward " << fwd.logLike() << " incremental " << incFwd.endLogLike()
+	   << " forward prefix " << fwdPrefixLogLike << " incremental prefix " << incFwd.prefixLogLike() << endl;
+      err = max (err, relativeError (fwd.logLike(), incFwd.endLogLike()));
+      prefixErr = max (prefixErr, relativeError (fwdPrefixLogLike, incFwd.prefixLogLike()));
+      if (outLen == output.size())
+	break;
+    }
+  }
+  cerr << "max relative error: " << err << " (prefix " << prefixErr << ")" << endl;
+
+  reportRelativeError ("incremental", err, maxLogLikeErr);
+  reportRelativeError ("prefix", prefixErr, maxLogLikeErr);
+  exit(0);
+}
@@ -1,17 +1,55 @@
 #include <iostream>
 #include <fstream>
+#include <random>
 #include <string.h>
 #include "../src/logsumexp.h"
 
 using namespace std;
 using namespace MachineBoss;
 
+// maximum errors allowed for the batch kernels
+#define LogSumExpArrayMaxError 1e-12  /* absolute */
+#define ExpArrayMaxError 1e-14  /* relative */
+
+int checkBatch (int trials) {
+  mt19937 mt (1);
+  uniform_real_distribution<double> value (-40, 10);
+  uniform_int_distribution<int> length (0, 40);
+  double lseErr = 0, expErr = 0;
+  for (int trial = 0; trial < trials; ++trial) {
+    vguard<double> x (length (mt));
+    for (auto& xi: x)
+      xi = (mt() % 8 == 0) ? -numeric_limits<double>::infinity() : value (mt);
+    double slow = -numeric_limits<double>::infinity();
+    for (auto xi: x)
+      log_accum_exp_slow (slow, xi);
+    const double fast = log_sum_exp_array (x.data(), x.size());
+    if (std::isinf(slow) ? (fast != slow) : std::isnan(fast))
+      lseErr = numeric_limits<double>::infinity();
+    else if (!std::isinf(slow))
+      lseErr = max (lseErr, abs (fast - slow));
+    vguard<double> y (x.size());
+    exp_array (x.data(), y.data(), x.size());
+    for (size_t i = 0; i < x.size(); ++i)
+      expErr = max (expErr, exp(x[i]) ? abs (y[i] / exp(x[i]) - 1) : abs (y[i]));
+  }
+  cerr << "(" << simd_kernel_name() << " kernels: log_sum_exp_array error " << lseErr << ", exp_array relative error " << expErr << ")" << endl;
+  const bool lseOk = lseErr <= LogSumExpArrayMaxError, expOk = expErr <= ExpArrayMaxError;
+  cout << "log_sum_exp_array: " << (lseOk ? "ok" : "error too large") << endl;
+  cout << "exp_array: " << (expOk ? "ok" : "error too large") << endl;
+  return lseOk && expOk ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 int main (int argc, char **argv) {
-  if (argc != 3 || (strcmp(argv[1],"-slow") != 0 && strcmp(argv[1],"-fast") != 0)) {
+  if (argc != 3 || (strcmp(argv[1],"-slow") != 0 && strcmp(argv[1],"-fast") != 0 && strcmp(argv[1],"-batch") != 0)) {
     cout << "Usage: " << argv[0] << " [-slow|-fast] <steps>\n";
+    cout << "       " << argv[0] << " -batch <trials>\n";
     exit (EXIT_FAILURE);
   }
 
+  if (strcmp(argv[1],"-batch") == 0)
+    exit (checkBatch (atoi (argv[2])));
+
   const bool slow = strcmp(argv[1],"-slow") == 0;
   const double steps = atof (argv[2]);
   const double max = 2, step = max / steps;
@@ -0,0 +1,55 @@
+#include <fstream>
+#include "../../src/backward.h"
+#include "../../src/viterbi.h"
+#include "relerror.h"
+
+using namespace MachineBoss;
+
+// Compares single- and double-precision DP matrix storage.
+// Prints "ok" or "not ok" for each comparison to stdout; the accuracy report goes to stderr.
+
+#define DefaultMaxLogLikeError 1e-5
+#define DefaultMaxCountError 1e-3
+
+int main (int argc, char** argv) {
+  if (argc < 4 || argc > 6) {
+    cerr << "Usage: " << argv[0] << " machine.json params.json seqpairlist.json [maxLogLikeError [maxCountError]]" << endl;
+    exit(1);
+  }
+  Machine machine = MachineLoader::fromFile (argv[1]);
+  Params params = JsonLoader<ParamAssign>::fromFile (argv[2]);
+  SeqPairList seqPairs = JsonLoader<SeqPairList>::fromFile (argv[3]);
+  const double maxLogLikeErr = argc > 4 ? atof (argv[4]) : DefaultMaxLogLikeError;
+  const double maxCountErr = argc > 5 ? atof (argv[5]) : DefaultMaxCountError;
+  EvaluatedMachine eval (machine, params);
+
+  double fwdErr = 0, backErr = 0, vitErr = 0, countErr = 0;
+  for (const auto& seqPair: seqPairs.seqPairs) {
+    const ForwardMatrix fwd (eval, seqPair);
+    const FloatForwardMatrix fwdFloat (eval, seqPair);
+    const BackwardMatrix back (eval, seqPair);
+    const FloatBackwardMatrix backFloat (eval, seqPair);
+    const ViterbiMatrix vit (eval, seqPair);
+    const FloatViterbiMatrix vitFloat (eval, seqPair);
+    MachineCounts counts (eval), countsFloat (eval);
+    back.getCounts (fwd, counts);
+    backFloat.getCounts (fwdFloat, countsFloat);
+    cerr << seqPair.input.name << " " << seqPair.output.name
+	 << " forward " << fwd.logLike() << " " << fwdFloat.logLike()
+	 << " backward " << back.logLike() << " " << backFloat.logLike()
+	 << " viterbi " << vit.logLike() << " " << vitFloat.logLike() << endl;
+    fwdErr = max (fwdErr, relativeError (fwd.logLike(), fwdFloat.logLike()));
+    backErr = max (backErr, relativeError (back.logLike(), backFloat.logLike()));
+    vitErr = max (vitErr, relativeError (vit.logLike(), vitFloat.logLike()));
+    for (StateIndex s = 0; s < counts.count.size(); ++s)
+      for (size_t t = 0; t < counts.count[s].size(); ++t)
+	countErr = max (countErr, relativeError (counts.count[s][t], countsFloat.count[s][t]));
+  }
+  cerr << "max relative error: forward " << fwdErr << " backward " << backErr << " viterbi " << vitErr << " counts " << countErr << endl;
+
+  reportRelativeError ("forward", fwdErr, maxLogLikeErr);
+  reportRelativeError ("backward", backErr, maxLogLikeErr);
+  reportRelativeError ("viterbi", vitErr, maxLogLikeErr);
+  reportRelativeError ("counts", countErr, maxCountErr);
+  exit(0);
+}
@@ -0,0 +1,45 @@
+#include <fstream>
+#include "../../src/backward.h"
+#include "../../src/viterbi.h"
+#include "relerror.h"
+
+using namespace MachineBoss;
+
+// Compares the score-only RollingOutput matrices, which keep two output rows, with the full matrices.
+// The rolling Backward log-likelihood is also checked against the Forward log-likelihood.
+// Prints "ok" or "not ok" for each comparison to stdout; the log-likelihoods go to stderr.
+
+#define DefaultMaxLogLikeError 1e-9
+
+int main (int argc, char** argv) {
+  if (argc < 4 || argc > 5) {
+    cerr << "Usage: " << argv[0] << " machine.json params.json seqpairlist.json [maxLogLikeError]" << endl;
+    exit(1);
+  }
+  Machine machine = MachineLoader::fromFile (argv[1]);
+  Params params = JsonLoader<ParamAssign>::fromFile (argv[2]);
+  SeqPairList seqPairs = JsonLoader<SeqPairList>::fromFile (argv[3]);
+  const double maxLogLikeErr = argc > 4 ? atof (argv[4]) : DefaultMaxLogLikeError;
+  EvaluatedMachine eval (machine, params);
+
+  double fwdErr = 0, backErr = 0, vitErr = 0;
+  for (const auto& seqPair: seqPairs.seqPairs) {
+    const ForwardMatrix fwd (eval, seqPair);
+    const RollingOutputForwardMatrix fwdRolling (eval, seqPair);
+    const RollingOutputBackwardMatrix backRolling (eval, seqPair);
+    const ViterbiMatrix vit (eval, seqPair);
+    const RollingOutputViterbiMatrix vitRolling (eval, seqPair);
+    cerr << seqPair.input.name << " " << seqPair.output.name
+	 << " forward " << fwd.logLike() << " " << fwdRolling.logLike()
+	 << " backward " << backRolling.logLike()
+	 << " viterbi " << vit.logLike() << " " << vitRolling.logLike() << endl;
+    fwdErr = max (fwdErr, relativeError (fwd.logLike(), fwdRolling.logLike()));
+    backErr = max (backErr, relativeError (fwd.logLike(), backRolling.logLike()));
+    vitErr = max (vitErr, relativeError (vit.logLike(), vitRolling.logLike()));
+  }
+
+  reportRelativeError ("forward", fwdErr, maxLogLikeErr);
+  reportRelativeError ("backward", backErr, maxLogLikeErr);
+  reportRelativeError ("viterbi", vitErr, maxLogLikeErr);
+  exit(0);
+}
@@ -0,0 +1,24 @@
+#include <fstream>
+#include "../../src/forward.h"
+
+using namespace MachineBoss;
+
+// Fills a Forward matrix in RAM, then again with --dp-scratch, and checks that the second one was memory-mapped and agrees with the first.
+int main (int argc, char** argv) {
+  if (argc != 4) {
+    cerr << "Usage: " << argv[0] << " machine.json params.json seqs.json" << endl;
+    exit(1);
+  }
+  Machine machine = MachineLoader::fromFile (argv[1]);
+  Params params = JsonLoader<ParamAssign>::fromFile (argv[2]);
+  SeqPair seqpair = JsonLoader<SeqPair>::fromFile (argv[3]);
+  EvaluatedMachine evalMachine (machine, params);
+  const ForwardMatrix inRam (evalMachine, seqpair);
+  cout << "Scratch files mapped without --dp-scratch: " << ScratchFileMap::nMapped << endl;
+  DPOptions options;
+  options.scratchDir = "/tmp";
+  const ForwardMatrix inFile (evalMachine, seqpair, options);
+  cout << "Scratch files mapped with --dp-scratch: " << ScratchFileMap::nMapped << endl;
+  cout << "Log-likelihoods " << (inRam.logLike() == inFile.logLike() ? "match" : "differ") << endl;
+  exit(0);
+}
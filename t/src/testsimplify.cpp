@@ -0,0 +1,20 @@
+#include <fstream>
+#include <iostream>
+#include "../../src/weight.h"
+#include "../../src/schema.h"
+
+using namespace std;
+using namespace MachineBoss;
+
+int main (int argc, char** argv) {
+  if (argc != 2) {
+    cerr << "Usage: " << argv[0] << " expr.json" << endl;
+    exit(1);
+  }
+  json w;
+  ifstream in (argv[1]);
+  in >> w;
+  MachineSchema::validateOrDie ("expr", w);
+  cout << WeightAlgebra::toJsonString(WeightAlgebra::fromJson(w)) << endl;
+  exit(0);
+}
@@ -20,7 +20,10 @@
 #include "../src/fitter.h"
 #include "../src/viterbi.h"
 #include "../src/forward.h"
+#include "../src/scaled.h"
+#include "../src/batch.h"
 #include "../src/counts.h"
+#include "../src/posterior.h"
 #include "../src/util.h"
 #include "../src/schema.h"
 #include "../src/parsers.h"
@@ -31,6 +34,8 @@
 #include "../src/ctc.h"
 #include "../src/beam.h"
 #include "../src/net.h"
+#include "../src/threadpool.h"
+#include "../src/planner.h"
 
 using namespace std;
 namespace po = boost::program_options;
@@ -184,6 +189,10 @@ int main (int argc, char** argv) {
       ("viterbi,V", "Viterbi log-likelihood calculation")
       ("loglike,L", "Forward log-likelihood calculation")
       ("counts,C", "Forward-Backward counts (derivatives of log-likelihood with respect to logs of parameters)")
+      ("posterior", "Forward-Backward posterior probabilities of aligned input & output positions (sparse)")
+      ("posterior-threshold", po::value<double>(), "minimum probability reported by --posterior (default 0.01)")
+      ("mea-align", "maximum expected accuracy alignment, from Forward-Backward posterior probabilities")
+      ("sample-paths", po::value<size_t>(), "sample this many alignments by stochastic Forward traceback, and report the distinct ones with their counts")
       ("beam-decode,Z", "find most likely input by beam search")
       ("beam-width", po::value<size_t>(), (string("number of sequences to track during beam search (default ") + to_string((size_t)DefaultBeamWidth) + ")").c_str())
       ("prefix-decode", "find most likely input by CTC prefix search")
@@ -197,6 +206,19 @@ int main (int argc, char** argv) {
       ("viterbi-encode", "find most likely output by Viterbi traceback")
       ("random-encode", "sample random output by stochastic prefix search")
       ("seed", po::value<int>(), "random number seed")
+      ("threads", po::value<size_t>(), "number of threads for --loglike, --viterbi, --align, --sample-paths, --posterior and --mea-align (0 = number of cores; default 1)")
+      ("wavefront", po::value<size_t>(), "number of threads for filling each Forward/Backward/Viterbi matrix, using tiled anti-diagonal wavefronts (0 = number of cores; default 1)")
+      ("wavefront-tile", po::value<size_t>(), (string("tile size for --wavefront (default ") + to_string((size_t)DefaultWavefrontTileSize) + ")").c_str())
+      ("dp-space", po::value<string>(), "arithmetic for Forward-Backward in --loglike, --counts and --train: 'log' (default) or 'prob' (rescaled probabilities; faster, but may underflow)")
+      ("dp-float", "store log-space DP matrix cells for --counts, --train, --align and --viterbi in single precision (halves memory; less accurate)")
+      ("dp-scratch", po::value<string>(), "directory for out-of-core DP: store full DP matrices in memory-mapped scratch files here, instead of in RAM")
+      ("max-memory", po::value<size_t>(), (string("memory budget for DP matrices, in megabytes, shared by --threads; --align, --counts, --train and --posterior use checkpointed DP above this (default ") + to_string((size_t)DefaultMaxDPMemoryMegabytes) + ")").c_str())
+      ("auto-band", po::value<size_t>(), "restrict --loglike, --viterbi, --align, --counts and --train to a band of the given width around a chain of k-mer seeds shared by input & output (for machines that mostly copy or substitute symbols); pairs with an alignment are restricted to it")
+      ("band-kmer", po::value<size_t>(), (string("k-mer length for --auto-band seeds (default ") + to_string((size_t)DefaultSeedKmerLength) + ")").c_str())
+      ("batch-lanes", po::value<size_t>(), (string("for --loglike, compute Forward log-likelihoods for this many sequence pairs of similar lengths at once, in lockstep (at most ") + to_string(MaxBatchLanes) + "; default 1)").c_str())
+      ("x-drop", po::value<double>(), "for --loglike, --viterbi and --align, skip DP cells more than this many nats below the best cell on their anti-diagonal (faster; log-likelihoods become lower bounds; pairs whose end cell is pruned away are refilled without pruning; not used by checkpointed DP)")
+      ("local-input", "for --loglike, --viterbi, --align, --counts, --train, --posterior and --sample-paths, let paths start and end anywhere in the input sequence (as --flank-input-wild, but without the extra states); --align and --sample-paths show the unaligned flanks as gap columns")
+      ("local-output", "as --local-input, but for the output sequence (with --local-input, as --flank-both-wild)")
       ;
 
     po::options_description compOpts("Parser-generator");
@@ -258,6 +280,42 @@ int main (int argc, char** argv) {
     }
     logger.parseLogArgs (vm);
 
+    // DP options
+    DPOptions dpOptions;
+
+    // wavefront-parallel DP
+    if (vm.count("wavefront")) {
+      const size_t wavefrontThreads = vm.at("wavefront").as<size_t>();
+      dpOptions.wavefront.threads = wavefrontThreads ? wavefrontThreads : WorkStealingPool::defaultThreads();
+    }
+    if (vm.count("wavefront-tile"))
+      dpOptions.wavefront.tileSize = vm.at("wavefront-tile").as<size_t>();
+
+    // Forward-Backward arithmetic
+    if (vm.count("dp-space")) {
+      const string space = vm.at("dp-space").as<string>();
+      Require (space == "log" || space == "prob", "--dp-space must be 'log' or 'prob'");
+      dpOptions.space = space == "prob" ? DPSpace::Prob : DPSpace::Log;
+    }
+    if (vm.count("dp-float")) {
+      Require (dpOptions.space == DPSpace::Log, "--dp-float can only be used with log-space DP");
+      dpOptions.cellType = DPCellType::Float;
+    }
+    if (vm.count("dp-scratch"))
+      dpOptions.scratchDir = vm.at("dp-scratch").as<string>();
+    if (vm.count("max-memory"))
+      dpOptions.maxMemory = vm.at("max-memory").as<size_t>() << 20;
+    PruningSettings pruning;
+    if (vm.count("x-drop")) {
+      Require (dpOptions.space == DPSpace::Log, "--x-drop can only be used with log-space DP");
+      pruning.xDrop = vm.at("x-drop").as<double>();
+      Require (pruning.xDrop >= 0, "--x-drop must be non-negative");
+    }
+    dpOptions.local.localInput = vm.count("local-input");
+    dpOptions.local.localOutput = vm.count("local-output");
+    if (dpOptions.local.enabled())
+      Require (dpOptions.space == DPSpace::Log && !pruning.enabled(), "--local-input and --local-output cannot be used with --dp-space prob or --x-drop");
+
     // random seed
     auto makeRnd = [&] () -> mt19937 {
       time_t timer;
@@ -651,7 +709,7 @@ int main (int argc, char** argv) {
     const bool paramsSpecified = vm.count("params") || vm.count("functions") || vm.count("norms");
     const bool encodingRequested = vm.count("prefix-encode") || vm.count("beam-encode") || vm.count("viterbi-encode") || vm.count("random-encode");
     const bool decodingRequested = vm.count("prefix-decode") || vm.count("cool-decode") || vm.count("viterbi-decode") || vm.count("mcmc-decode") || vm.count("beam-decode");
-    const bool dpRequested = vm.count("train") || vm.count("loglike") || vm.count("viterbi") || vm.count("align") || vm.count("counts");
+    const bool dpRequested = vm.count("train") || vm.count("loglike") || vm.count("viterbi") || vm.count("align") || vm.count("counts") || vm.count("posterior") || vm.count("mea-align") || vm.count("sample-paths");
     const bool inferenceRequested = dpRequested || encodingRequested || decodingRequested;
     const bool evalRequested = vm.count("evaluate");
     if (paramsSpecified	&& (evalRequested || !inferenceRequested)) {
@@ -772,6 +830,21 @@ int main (int argc, char** argv) {
     const bool gotData = !data.seqPairs.empty();
     Require (!gotData || inferenceRequested, "No point in specifying input/output data without --train, --loglike, --counts, --align, --*-encode, or --*-decode");
 
+    // seed-based banding
+    const bool autoBand = vm.count("auto-band");
+    Require (!autoBand || !vm.count("wiggle-room"), "--auto-band and --wiggle-room cannot be used together");
+    const list<Envelope> bandEnvelopes = autoBand
+      ? data.seedEnvelopes (vm.count("band-kmer") ? vm.at("band-kmer").as<size_t>() : DefaultSeedKmerLength, vm.at("auto-band").as<size_t>())
+      : list<Envelope>();
+    const vguard<Envelope> bandEnvelope (bandEnvelopes.begin(), bandEnvelopes.end());
+    auto pairEnvelopes = [&] (const vguard<SeqPair>& seqPairs) {
+      vguard<Envelope> envs;
+      envs.reserve (seqPairs.size());
+      for (size_t n = 0; n < seqPairs.size(); ++n)
+	envs.push_back (autoBand ? bandEnvelope[n] : Envelope (seqPairs[n]));
+      return envs;
+    };
+
     // fit parameters
     Params params;
     if (vm.count("train")) {
@@ -784,68 +857,287 @@ int main (int argc, char** argv) {
 	fitter.constraints = constraints;
       fitter.constants = funcs;
       fitter.seed = fitter.allConstraints().defaultParams().combine (seed, true);
-      params = vm.count("wiggle-room") ? fitter.fit(data,vm.at("wiggle-room").as<int>()) : fitter.fit(data);
+      fitter.options = dpOptions;
+      params = vm.count("wiggle-room") ? fitter.fit(data,vm.at("wiggle-room").as<int>()) : (autoBand ? fitter.fit(data,bandEnvelopes) : fitter.fit(data));
       cout << JsonLoader<Params>::toJsonString(params) << endl;
     } else
       params = funcs.combine (seed).combine (machine.getParamDefs (vm.count("use-defaults")));
 
+    // number of threads for batch inference
+    const size_t nThreads = vm.count("threads") ? vm.at("threads").as<size_t>() : 1;
+    const size_t poolThreads = nThreads ? nThreads : WorkStealingPool::defaultThreads();
+    WorkStealingPool pool (poolThreads);
+
+    // when the pool fills several sequence pairs at once, each fill may also use wavefront threads, so share the cores between them.
+    // Fills that run one at a time (--counts, --sample-paths) get all the --wavefront threads
+    const size_t wavefrontThreads = dpOptions.wavefront.threads;
+    auto setConcurrentFills = [&] (size_t nPairs) {
+      const size_t nConcurrent = min (poolThreads, nPairs);
+      const size_t wavefrontCap = max ((size_t) 1, WorkStealingPool::defaultThreads() / max ((size_t) 1, nConcurrent));
+      dpOptions.wavefront.threads = wavefrontThreads;
+      if (nConcurrent > 1 && wavefrontThreads > wavefrontCap) {
+	LogThisAt(2,"Reducing --wavefront from " << plural(wavefrontThreads,"thread") << " to " << wavefrontCap << " per matrix, since " << plural(nConcurrent,"sequence pair") << " may be filled at once" << endl);
+	dpOptions.wavefront.threads = wavefrontCap;
+      }
+    };
+
     // compute sequence log-likelihoods
     if (vm.count("loglike")) {
       const EvaluatedMachine eval (machine, params);
+      const vguard<SeqPair> seqPairs (data.seqPairs.begin(), data.seqPairs.end());
+      const vguard<Envelope> envs = pairEnvelopes (seqPairs);
+      const vguard<DPPlan> plans = DPPlanner (eval, dpOptions, min (poolThreads, seqPairs.size())).planBatch (DPTask::Score, seqPairs, envs);
+      setConcurrentFills (seqPairs.size());
+      vguard<double> fwdLogLike (seqPairs.size(), -numeric_limits<double>::infinity());
+      vguard<int> fwdPruned (seqPairs.size(), false), fwdDisconnected (seqPairs.size(), false), fwdUnderflow (seqPairs.size(), false);
+      const size_t batchLanes = vm.count("batch-lanes") ? vm.at("batch-lanes").as<size_t>() : 1;
+      Require (batchLanes >= 1 && batchLanes <= MaxBatchLanes, "--batch-lanes must be between 1 and %d", MaxBatchLanes);
+      if (batchLanes > 1)
+	Require (dpOptions.space == DPSpace::Log && !autoBand && !pruning.enabled() && !dpOptions.local.enabled(), "--batch-lanes cannot be used with --dp-space prob, --auto-band, --x-drop, --local-input or --local-output");
+      // sequence pairs with alignments are restricted to their alignment path, so are not batched
+      vguard<size_t> batched, unbatched;
+      for (size_t n: DPPlanner::smoothOrder (plans))
+	if (eval.canTokenize (seqPairs[n]))
+	  (batchLanes > 1 && seqPairs[n].alignment.empty() ? batched : unbatched).push_back (n);
+      if (batched.size()) {
+	// sort by length, so that each batch holds sequence pairs of similar lengths
+	stable_sort (batched.begin(), batched.end(), [&] (size_t a, size_t b) {
+	    return make_pair (seqPairs[a].output.seq.size(), seqPairs[a].input.seq.size()) < make_pair (seqPairs[b].output.seq.size(), seqPairs[b].input.seq.size());
+	  });
+	const BatchTransTable batchTable (eval);
+	pool.run ((batched.size() + batchLanes - 1) / batchLanes, [&] (size_t b) {
+	    const size_t begin = b * batchLanes, end = min (batched.size(), begin + batchLanes);
+	    vguard<const SeqPair*> batch;
+	    for (size_t k = begin; k < end; ++k)
+	      batch.push_back (&seqPairs[batched[k]]);
+	    const BatchForwardMatrix forward (eval, batchTable, batch);
+	    for (size_t k = begin; k < end; ++k)
+	      fwdLogLike[batched[k]] = forward.logLike()[k - begin];
+	  });
+      }
+      pool.run (unbatched.size(), [&] (size_t k) {
+	  const size_t n = unbatched[k];
+	  const SeqPair& seqPair = seqPairs[n];
+	  const Envelope& env = envs[n];
+	  if (dpOptions.space == DPSpace::Prob) {
+	    const RollingOutputScaledForwardMatrix forward (eval, seqPair, env, dpOptions);
+	    fwdLogLike[n] = forward.logLike();
+	    if (forward.mayHaveUnderflowed()) {  // redo in log space
+	      DPOptions logOptions (dpOptions);
+	      logOptions.space = DPSpace::Log;
+	      const RollingOutputForwardMatrix logForward (eval, seqPair, env, logOptions);
+	      fwdUnderflow[n] = logForward.logLike() > -numeric_limits<double>::infinity();
+	      fwdLogLike[n] = logForward.logLike();
+	    }
+	  } else if (pruning.enabled()) {
+	    const RollingDiagonalForwardMatrix forward (eval, seqPair, env, pruning, dpOptions);
+	    fwdLogLike[n] = forward.logLike();
+	    fwdPruned[n] = forward.pruned;
+	    if (forward.pruned && fwdLogLike[n] == -numeric_limits<double>::infinity()) {  // pruning disconnected the end cell, so refill without it
+	      const RollingOutputForwardMatrix unprunedForward (eval, seqPair, env, dpOptions);
+	      fwdLogLike[n] = unprunedForward.logLike();
+	      fwdPruned[n] = false;
+	      fwdDisconnected[n] = true;
+	    }
+	  } else {
+	    const RollingOutputForwardMatrix forward (eval, seqPair, env, dpOptions);
+	    fwdLogLike[n] = forward.logLike();
+	  }
+	});
       cout << "[";
-      size_t n = 0;
-      for (const auto& seqPair: data.seqPairs) {
-	double fwdLogLike = -numeric_limits<double>::infinity();
-	if (eval.canTokenize (seqPair)) {
-	  const RollingOutputForwardMatrix forward (eval, seqPair);
-	  fwdLogLike = forward.logLike();
-	}
-	cout << (n++ ? ",\n " : "")
+      for (size_t n = 0; n < seqPairs.size(); ++n) {
+	const SeqPair& seqPair = seqPairs[n];
+	cout << (n ? ",\n " : "")
 	     << "[\"" << escaped_str(seqPair.input.name)
 	     << "\",\"" << escaped_str(seqPair.output.name)
-	     << "\"," << toInfinitySafeString (fwdLogLike) << "]";
+	     << "\"," << toInfinitySafeString (fwdLogLike[n]) << "]";
       }
       cout << "]\n";
+      const size_t nPruned = count (fwdPruned.begin(), fwdPruned.end(), true);
+      if (nPruned)
+	Warn ("X-drop pruning was used for %lu of %lu Forward log-likelihoods; these are lower bounds", nPruned, seqPairs.size());
+      const size_t nDisconnected = count (fwdDisconnected.begin(), fwdDisconnected.end(), true);
+      if (nDisconnected)
+	Warn ("X-drop pruning disconnected the end cell for %lu of %lu sequence pairs; their Forward log-likelihoods were recomputed without pruning", nDisconnected, seqPairs.size());
+      const size_t nUnderflow = count (fwdUnderflow.begin(), fwdUnderflow.end(), true);
+      if (nUnderflow)
+	Warn ("Probability-space Forward underflowed for %lu of %lu sequence pairs; these were recomputed in log space", nUnderflow, seqPairs.size());
     }
 
     // compute counts
     if (vm.count("counts")) {
       const EvaluatedMachine eval (machine, params);
-      const MachineCounts counts (eval, data);
+      const vguard<SeqPair> seqPairs (data.seqPairs.begin(), data.seqPairs.end());
+      (void) DPPlanner (eval, dpOptions).planBatch (DPTask::ForwardBackward, seqPairs, pairEnvelopes (seqPairs));
+      setConcurrentFills (1);
+      const MachineCounts counts (eval, data, bandEnvelopes, dpOptions);
       counts.writeParamCountsJson (cout, machine, params);
       cout << endl;
     }
 
+    // posterior probabilities and MEA alignment, sharing one Forward-Backward pass per sequence pair
+    if (vm.count("posterior") || vm.count("mea-align")) {
+      Require (gotData, "To compute posterior probabilities, please specify a data file");
+      const EvaluatedMachine eval (machine, params);
+      const vguard<SeqPair> seqPairs (data.seqPairs.begin(), data.seqPairs.end());
+      const double threshold = vm.count("posterior-threshold") ? vm.at("posterior-threshold").as<double>() : DefaultPosteriorThreshold;
+      const bool wantPosterior = vm.count("posterior"), wantMEA = vm.count("mea-align");
+      vguard<string> posterior (seqPairs.size());
+      vguard<SeqPair> meaAlignment (seqPairs.size());
+      vguard<int> gotPosterior (seqPairs.size(), false);
+      const vguard<Envelope> envs = pairEnvelopes (seqPairs);
+      const vguard<DPPlan> plans = DPPlanner (eval, dpOptions, min (poolThreads, seqPairs.size())).planBatch (DPTask::ForwardBackward, seqPairs, envs);
+      const vguard<size_t> order = DPPlanner::smoothOrder (plans);
+      setConcurrentFills (seqPairs.size());
+      pool.run (seqPairs.size(), [&] (size_t k) {
+	  const size_t n = order[k];
+	  const SeqPair& seqPair = seqPairs[n];
+	  if (eval.canTokenize (seqPair)) {
+	    const PosteriorMatrix post (eval, seqPair, envs[n], plans[n].variant, dpOptions);
+	    if (post.logLike > -numeric_limits<double>::infinity()) {
+	      gotPosterior[n] = true;
+	      if (wantPosterior) {
+		ostringstream out;
+		post.writeSparseJson (out, threshold);
+		posterior[n] = out.str();
+	      }
+	      if (wantMEA)
+		meaAlignment[n] = post.meaAlignment();
+	    }
+	  }
+	});
+      if (wantPosterior) {
+	vguard<string> results;
+	for (size_t n = 0; n < seqPairs.size(); ++n)
+	  if (gotPosterior[n])
+	    results.push_back (posterior[n]);
+	cout << "[" << join (results, ",\n ") << "]" << endl;
+      }
+      if (wantMEA) {
+	SeqPairList meaResults;
+	for (size_t n = 0; n < seqPairs.size(); ++n)
+	  if (gotPosterior[n])
+	    meaResults.seqPairs.push_back (meaAlignment[n]);
+	meaResults.writeJson (cout);
+	cout << endl;
+      }
+    }
+
+    // sample alignments, concurrently, from each sequence pair's Forward matrix
+    if (vm.count("sample-paths")) {
+      Require (gotData, "To sample alignments, please specify a data file");
+      const EvaluatedMachine eval (machine, params);
+      const size_t nPaths = vm.at("sample-paths").as<size_t>();
+      const vguard<SeqPair> seqPairs (data.seqPairs.begin(), data.seqPairs.end());
+      const vguard<Envelope> envs = pairEnvelopes (seqPairs);
+      (void) DPPlanner (eval, dpOptions).planBatch (DPTask::Sample, seqPairs, envs);
+      setConcurrentFills (1);  // the pool only samples paths from each filled matrix
+      mt19937 rnd = makeRnd();
+      const unsigned int seed = rnd();
+      SeqPairList sampleResults;
+      size_t n = 0;
+      for (const auto& seqPair: seqPairs) {
+	if (eval.canTokenize (seqPair)) {
+	  const ForwardMatrix forward (eval, seqPair, envs[n], dpOptions);
+	  if (forward.logLike() > -numeric_limits<double>::infinity())
+	    for (const auto& sampled: forward.samplePaths (machine, nPaths, vguard<unsigned int> ({ seed, (unsigned int) n }), pool)) {
+	      const MachineBoundPath path (sampled.path, machine);
+	      SeqPair alignment = SeqPair::seqPairFromPath (path, seqPair, sampled.inStart, sampled.outStart);  // local alignments are padded with the unaligned flanks
+	      alignment.metadata["count"] = sampled.count;
+	      sampleResults.seqPairs.push_back (alignment);
+	    }
+	}
+	++n;
+      }
+      sampleResults.writeJson (cout);
+      cout << endl;
+    }
+
     // align sequences
     if (vm.count("align") || vm.count("viterbi")) {
       Require (gotData, "To align sequences, please specify a data file");
       const EvaluatedMachine eval (machine, params);
-      if (vm.count("viterbi"))
-	cout << "[";
-      size_t n = 0;
-      SeqPairList alignResults;
-      for (const auto& seqPair: data.seqPairs) {
-	double vitLogLike = -numeric_limits<double>::infinity();
-	if (eval.canTokenize (seqPair)) {
-	  const ViterbiMatrix viterbi (eval, seqPair);
-	  vitLogLike = viterbi.logLike();
-	  if (vitLogLike > -numeric_limits<double>::infinity()) {
-	    const MachineBoundPath path (viterbi.path (machine), machine);
-	    alignResults.seqPairs.push_back (SeqPair::seqPairFromPath (path, seqPair.input.name.c_str(), seqPair.output.name.c_str()));
+      const vguard<SeqPair> seqPairs (data.seqPairs.begin(), data.seqPairs.end());
+      vguard<double> vitLogLike (seqPairs.size(), -numeric_limits<double>::infinity());
+      vguard<int> vitPruned (seqPairs.size(), false), vitDisconnected (seqPairs.size(), false);
+      vguard<SeqPair> alignment (seqPairs.size());
+      const bool wantAlign = vm.count("align");
+      const vguard<Envelope> envs = pairEnvelopes (seqPairs);
+      const vguard<DPPlan> plans = DPPlanner (eval, dpOptions, min (poolThreads, seqPairs.size())).planBatch (wantAlign ? DPTask::Traceback : DPTask::Score, seqPairs, envs);
+      const vguard<size_t> order = DPPlanner::smoothOrder (plans);
+      setConcurrentFills (seqPairs.size());
+      pool.run (seqPairs.size(), [&] (size_t k) {
+	  const size_t n = order[k];
+	  const SeqPair& seqPair = seqPairs[n];
+	  if (eval.canTokenize (seqPair)) {
+	    const Envelope& env = envs[n];
+	    MachinePath vitPath;
+	    Envelope::InputIndex vitInStart = 0;  // where a local alignment starts
+	    Envelope::OutputIndex vitOutStart = 0;
+	    auto fillViterbi = [&] (const PruningSettings& xDrop) {
+	      if (!wantAlign && xDrop.enabled()) {
+		const RollingDiagonalViterbiMatrix viterbi (eval, seqPair, env, xDrop, dpOptions);  // score only, so three anti-diagonals suffice
+		vitLogLike[n] = viterbi.logLike();
+		vitPruned[n] = viterbi.pruned;
+	      } else if (!wantAlign) {
+		const RollingOutputViterbiMatrix viterbi (eval, seqPair, env, dpOptions);  // score only, so two rows suffice
+		vitLogLike[n] = viterbi.logLike();
+	      } else if (plans[n].variant == DPVariant::Checkpointed) {
+		CheckpointedViterbiMatrix viterbi (eval, seqPair, env, dpOptions);
+		vitLogLike[n] = viterbi.logLike();
+		if (vitLogLike[n] > -numeric_limits<double>::infinity())
+		  vitPath = viterbi.path (machine, vitInStart, vitOutStart);
+	      } else if (dpOptions.cellType == DPCellType::Float) {
+		const FloatViterbiMatrix viterbi (eval, seqPair, env, xDrop, dpOptions);
+		vitLogLike[n] = viterbi.logLike();
+		vitPruned[n] = viterbi.pruned;
+		if (vitLogLike[n] > -numeric_limits<double>::infinity())
+		  vitPath = viterbi.path (machine, vitInStart, vitOutStart);
+	      } else {
+		const ViterbiMatrix viterbi (eval, seqPair, env, xDrop, dpOptions);
+		vitLogLike[n] = viterbi.logLike();
+		vitPruned[n] = viterbi.pruned;
+		if (vitLogLike[n] > -numeric_limits<double>::infinity())
+		  vitPath = viterbi.path (machine, vitInStart, vitOutStart);
+	      }
+	    };
+	    fillViterbi (pruning);
+	    if (vitPruned[n] && vitLogLike[n] == -numeric_limits<double>::infinity()) {  // pruning disconnected the end cell, so refill without it
+	      vitPruned[n] = false;
+	      vitDisconnected[n] = true;
+	      fillViterbi (PruningSettings());
+	    }
+	    if (vitLogLike[n] > -numeric_limits<double>::infinity() && wantAlign) {
+	      const MachineBoundPath path (vitPath, machine);
+	      alignment[n] = SeqPair::seqPairFromPath (path, seqPair, vitInStart, vitOutStart);  // local alignments are padded with the unaligned flanks
+	    }
 	  }
-	}
-	if (vm.count("viterbi"))
-	  cout << (n++ ? ",\n " : "")
+	});
+      if (vm.count("viterbi")) {
+	cout << "[";
+	for (size_t n = 0; n < seqPairs.size(); ++n) {
+	  const SeqPair& seqPair = seqPairs[n];
+	  cout << (n ? ",\n " : "")
 	       << "[\"" << escaped_str(seqPair.input.name)
 	       << "\",\"" << escaped_str(seqPair.output.name)
-	       << "\"," << toInfinitySafeString (vitLogLike) << "]";
-      }
-      if (vm.count("viterbi"))
+	       << "\"," << toInfinitySafeString (vitLogLike[n]) << "]";
+	}
 	cout << "]\n";
+      }
       if (vm.count("align")) {
+	SeqPairList alignResults;
+	for (size_t n = 0; n < seqPairs.size(); ++n)
+	  if (vitLogLike[n] > -numeric_limits<double>::infinity())
+	    alignResults.seqPairs.push_back (alignment[n]);
 	alignResults.writeJson (cout);
 	cout << endl;
       }
+      const size_t nPruned = count (vitPruned.begin(), vitPruned.end(), true);
+      if (nPruned)
+	Warn ("X-drop pruning was used for %lu of %lu Viterbi alignments; their log-likelihoods are lower bounds, and may not be optimal", nPruned, seqPairs.size());
+      const size_t nDisconnected = count (vitDisconnected.begin(), vitDisconnected.end(), true);
+      if (nDisconnected)
+	Warn ("X-drop pruning disconnected the end cell for %lu of %lu sequence pairs; their Viterbi alignments were recomputed without pruning", nDisconnected, seqPairs.size());
     }
 
     // encode